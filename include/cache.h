@@ -0,0 +1,111 @@
+#ifndef _CACHE_H_
+#define _CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "interpreter.h"
+
+#define CACHE_MAGIC		"BFDC"
+#define CACHE_PREFIX_MAGIC	"BFDP"
+
+// Bump this whenever the layout of cache files or of struct Op changes
+#define CACHE_VERSION	1
+
+/*
+ * What a cached program was built from. A cache file is only used if all of
+ * this matches.
+ *
+ * hash				A 128-bit hash of the source file
+ * source_length	The length of the source file in bytes
+ * cell_size		The VM's cell size
+ * tape_size		The VM's tape length, which compiled loops depend on
+ * flags			The PROGRAM_* flags hot loops are compiled with
+ */
+typedef struct {
+	uint64_t hash[2];
+	uint64_t source_length;
+	uint64_t cell_size;
+	uint64_t tape_size;
+	uint64_t flags;
+} CacheKey;
+
+/*
+ * Works out the key for a program. This reads all of src, but does much
+ * less work per byte than loading it.
+ *
+ * key		The key to fill in
+ * n		The length of src
+ * src		The contents of the source file
+ * vm		The VM the program will run on
+ */
+void Cache_key(CacheKey *key, size_t n, const char *src, const struct BrainfuckVM *vm);
+
+/*
+ * Returns the path of the cache file for a key, in $XDG_CACHE_HOME/bfdbg or
+ * ~/.cache/bfdbg. The caller frees it. Returns NULL and sets errno if there
+ * is nowhere to put the cache.
+ *
+ * key		The key
+ */
+char *Cache_path(const CacheKey *key);
+
+/*
+ * Loads a cached program into a VM with nothing loaded, in place of
+ * interpreter_load. Hot loops which had been compiled when the cache was
+ * saved are installed straight away.
+ *
+ * vm		The VM to load into
+ * key		The program's key
+ *
+ * Returns 0 on success. Returns -1 and sets errno if there's no usable cache
+ * file, in which case the VM is left empty.
+ */
+int Cache_load(struct BrainfuckVM *vm, const CacheKey *key);
+
+/*
+ * Saves a VM's program, along with any of its loops which have been compiled.
+ * The file is written under a temporary name and then renamed, so readers
+ * only ever see complete files.
+ *
+ * vm		The VM to save
+ * key		The key of the program loaded into it
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int Cache_save(const struct BrainfuckVM *vm, const CacheKey *key);
+
+/*
+ * Loads the state a program was left in by interpreter_prefix, in place of
+ * running it again. The VM must have just been loaded.
+ *
+ * vm		The VM to load into
+ * key		The program's key
+ * budget	The budget interpreter_prefix was given
+ *
+ * Returns 0 on success. Returns -1 and sets errno if there's no usable cache
+ * file, in which case the VM is left as it was.
+ */
+int Cache_load_prefix(struct BrainfuckVM *vm, const CacheKey *key, uint64_t budget);
+
+/*
+ * Saves the state a program was left in by interpreter_prefix. Only the part
+ * of the tape between the first and last non-zero cells is kept.
+ *
+ * vm		The VM, straight after interpreter_prefix
+ * key		The key of the program loaded into it
+ * budget	The budget interpreter_prefix was given
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int Cache_save_prefix(const struct BrainfuckVM *vm, const CacheKey *key, uint64_t budget);
+
+/*
+ * Returns the number of a VM's loops which have been compiled, for telling
+ * whether it's worth saving again.
+ *
+ * vm		The VM
+ */
+size_t Cache_compiled_loops(const struct BrainfuckVM *vm);
+
+#endif  // _CACHE_H_
@@ -46,6 +46,14 @@ void StringCassette_free(StringCassette *c);
  */
 void StringCassette_write(StringCassette *c, const char *s);
 
+/*
+ * Writes a single character to the cassette.
+ *
+ * c		The cassette to write to
+ * ch		The character to write
+ */
+void StringCassette_put(StringCassette *c, char ch);
+
 /*
  * Read data out of the cassette.
  *
@@ -58,5 +66,18 @@ void StringCassette_write(StringCassette *c, const char *s);
  */
 size_t StringCassette_read(StringCassette *c, size_t n, char *buf, size_t offset);
 
+/*
+ * Copies the last bytes written to the cassette, oldest first. Parts of the
+ * cassette which haven't been written yet are copied as null bytes.
+ *
+ * c		The cassette to read from
+ * n		The maximum number of bytes to copy
+ * buf		The buffer to copy into
+ *
+ * Returns the number of bytes copied, which is n or the cassette's length,
+ * whichever is smaller
+ */
+size_t StringCassette_tail(const StringCassette *c, size_t n, char *buf);
+
 #endif  // _CASSETTE_H_
 
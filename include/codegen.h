@@ -0,0 +1,58 @@
+#ifndef _CODEGEN_H_
+#define _CODEGEN_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "input.h"
+#include "program.h"
+
+/*
+ * The VM semantics generated code has to reproduce
+ *
+ * cell_size		The size of each cell in bytes
+ * tape_size		The length of the memory tape
+ * eof_behaviour	What , does to the current cell at EOF
+ * dump_state		Whether the program writes its final state to stderr when it
+ * 					ends: the pointer, then every cell, as uint64_t values in
+ * 					the host's byte order. This is for checking the generated
+ * 					code against the interpreter.
+ */
+struct CodegenOptions {
+	size_t cell_size;
+	size_t tape_size;
+	enum EOFBehaviour eof_behaviour;
+	bool dump_state;
+};
+
+/*
+ * Translates a compiled program to a standalone C program, which reads input
+ * from stdin and writes output to stdout.
+ *
+ * p		The program to translate. It must have been compiled for
+ * 			opt->tape_size.
+ * fp		The file to write the C source to
+ * opt		The semantics to generate
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int codegen_c(const Program *p, FILE *fp, const struct CodegenOptions *opt);
+
+/*
+ * Translates a compiled program to C and builds it into an executable with
+ * the system C compiler. The compiler is taken from the CC environment
+ * variable, and defaults to cc. CC is split into words on whitespace, so it
+ * can carry flags ("gcc -m32"), but quoting isn't supported. The C source is written to a temporary file
+ * in $TMPDIR, or /tmp if it isn't set.
+ *
+ * p		The program to build
+ * path		The path of the executable to create
+ * opt		The semantics to generate
+ *
+ * Returns 0 on success. Returns -1 on failure, with errno set if the
+ * compiler could not be run.
+ */
+int codegen_executable(const Program *p, const char *path, const struct CodegenOptions *opt);
+
+#endif  // _CODEGEN_H_
@@ -0,0 +1,166 @@
+#ifndef _INPUT_H_
+#define _INPUT_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <threads.h>
+
+// Size of the read buffer used for pipes
+#define INPUT_BUFFER_SIZE	(1 << 20)
+
+// Special return values for InputSource_getc
+#define INPUT_EOF	(-1)  // The source has no more data
+#define INPUT_AGAIN	(-2)  // No data is available yet; try again later
+
+/*
+ * Where the program's input comes from
+ *
+ * INPUT_FILE			A regular file mapped into memory
+ * INPUT_PIPE			A file descriptor which is read in large blocks as data
+ * 						becomes available
+ * INPUT_INTERACTIVE	Lines typed into the UI
+ */
+enum InputSourceType {
+	INPUT_FILE,
+	INPUT_PIPE,
+	INPUT_INTERACTIVE
+};
+
+/*
+ * What happens to the current cell when , is executed at EOF
+ *
+ * EOF_UNCHANGED	The cell is left as-is
+ * EOF_ZERO			The cell is set to 0
+ * EOF_NEGATIVE		The cell is set to -1 (all bits set)
+ */
+enum EOFBehaviour {
+	EOF_UNCHANGED,
+	EOF_ZERO,
+	EOF_NEGATIVE
+};
+
+/*
+ * A buffered source of program input. Bytes are always read out of _data;
+ * the underlying source is only touched once the buffer has been drained, so
+ * reading a byte never costs a syscall.
+ *
+ * type			The kind of source backing this input
+ * error		The errno of the last read from a pipe which failed, or 0.
+ * 				A failed read leaves the reader waiting, as if no data was
+ * 				available yet, rather than ending the input.
+ *
+ * _fd			The file descriptor for INPUT_FILE and INPUT_PIPE sources
+ * _data		The buffer currently being read from. For INPUT_FILE this is
+ * 				the mapping of the whole file.
+ * _length		The number of valid bytes in _data
+ * _pos			Offset of the next unread byte in _data
+ * _eof			Set once the underlying source has no more data
+ *
+ * _pending		Interactive only. Lines submitted by the UI which have not
+ * 				been handed to the reader yet. This is swapped with _data
+ * 				once _data is drained.
+ * _pending_length	The number of valid bytes in _pending
+ * _pending_eof	Interactive only. Set when the user ends the input
+ * _lock		Interactive only. Guards the _pending buffer
+ * _starved		Set while the reader is waiting on interactive input
+ */
+typedef struct {
+	enum InputSourceType type;
+	int error;
+
+	int _fd;
+	uint8_t *_data;
+	size_t _length;
+	size_t _pos;
+	bool _eof;
+
+	uint8_t *_pending;
+	size_t _pending_length;
+	bool _pending_eof;
+	mtx_t _lock;
+
+	_Atomic bool _starved;
+} InputSource;
+
+/*
+ * Opens a file as an input source. Regular files are mapped into memory;
+ * anything else (including "-" for stdin) is read as a pipe.
+ *
+ * in		The input source to initialize
+ * path		The path of the file, or "-" for stdin
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int InputSource_open(InputSource *in, const char *path);
+
+/*
+ * Initializes an interactive input source, which is fed by InputSource_push.
+ *
+ * in		The input source to initialize
+ */
+void InputSource_init_interactive(InputSource *in);
+
+/*
+ * Frees an input source. After this runs, the source is invalid unless
+ * reinitialized.
+ *
+ * in		The input source to free
+ */
+void InputSource_free(InputSource *in);
+
+/*
+ * Moves an input source back to its start. Files restart from the first
+ * byte and interactive sources discard any unread input. Pipes cannot be
+ * rewound and are left as-is.
+ *
+ * in		The input source to rewind
+ */
+void InputSource_rewind(InputSource *in);
+
+/*
+ * Appends data to an interactive input source.
+ *
+ * in		The input source to append to
+ * n		The number of bytes to append
+ * data		The bytes to append
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int InputSource_push(InputSource *in, size_t n, const char *data);
+
+/*
+ * Marks the end of an interactive input source. Once the buffered input has
+ * been read, InputSource_getc will return INPUT_EOF.
+ *
+ * in		The input source to close
+ */
+void InputSource_close(InputSource *in);
+
+/*
+ * Refills the buffer of an input source. This is the slow path of
+ * InputSource_getc and should not be called directly.
+ */
+int _InputSource_refill(InputSource *in);
+
+/*
+ * Reads a byte from an input source.
+ *
+ * Returns the byte, INPUT_EOF if the source is exhausted, or INPUT_AGAIN if
+ * an interactive source is waiting for more input or a pipe has nothing ready
+ * to read.
+ */
+static inline int InputSource_getc(InputSource *in) {
+	if (in->_pos < in->_length) return in->_data[in->_pos++];
+
+	return _InputSource_refill(in);
+}
+
+/*
+ * Returns true if the reader of an interactive input source is waiting for
+ * more input.
+ */
+#define InputSource_starved(in) ((in)->_starved)
+
+#endif  // _INPUT_H_
@@ -1,14 +1,64 @@
 #ifndef _INTERPRETER_H_
 #define _INTERPRETER_H_
 
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <string.h>
 #include <threads.h>
 #include <time.h>
 
 #include "cassette.h"
+#include "input.h"
+#include "program.h"
 #include "queue.h"
+#include "snapshot.h"
+#include "summary.h"
+#include "tier.h"
+#include "trace.h"
+
+/*
+ * Why interpreter_run last stopped
+ *
+ * INTERPRETER_OK		It executed as many instructions as it was asked to
+ * INTERPRETER_END		It ran out of instructions (possibly in the middle of a
+ * 						loop whose end hasn't been received yet)
+ * INTERPRETER_INPUT	It is waiting for program input
+ * INTERPRETER_BREAK	It reached a breakpoint, and paused the VM
+ * INTERPRETER_UNTIL	It got to what the VM was running until, and paused the
+ * 						VM
+ */
+enum InterpreterStatus {
+	INTERPRETER_OK,
+	INTERPRETER_END,
+	INTERPRETER_INPUT,
+	INTERPRETER_BREAK,
+	INTERPRETER_UNTIL
+};
+
+/*
+ * What the VM is running until. Once it gets there the interpreter pauses
+ * the VM and sets BrainfuckVM.until back to UNTIL_NONE. It also gives up if
+ * it reaches a breakpoint, runs out of instructions or has to wait for input
+ * first.
+ *
+ * UNTIL_NONE		Running normally
+ * UNTIL_BREAK		Until a breakpoint or the end of the program
+ * UNTIL_OUTPUT		Until a . has been executed
+ * UNTIL_POINTER	Until a < or > moves the pointer onto until_cell
+ * UNTIL_VALUE		Until a write sets until_cell to until_value
+ * UNTIL_INPUT		Until a , is reached. Unlike the others this stops before
+ * 					the instruction, which is left for when the VM carries on.
+ */
+enum RunUntil {
+	UNTIL_NONE,
+	UNTIL_BREAK,
+	UNTIL_OUTPUT,
+	UNTIL_POINTER,
+	UNTIL_VALUE,
+	UNTIL_INPUT
+};
 
 /*
  * cell_size		The size of each cell in bytes
@@ -20,12 +70,72 @@
  * stop_after		How many instructions to automatically pause after. 0 halts
  * 					the interpreter. -1 executes indefinitely.
  * tick_delay		Timespec specifying how long between ticks to sleep the
- * 					interpreter thread.
+ * 					interpreter thread. Only set while the thread isn't running.
+ * skip_delay		If true, the interpreter thread yields between ticks
+ * 					instead of sleeping for tick_delay, so that it notices
+ * 					changes straight away
  * die				If true, the interpreter dies at its soonest convenience
  *
- * instructionQueue	A queue containing the program's instructions
+ * until			A RunUntil saying what the VM is running until. The UI sets
+ * 					until_cell and until_value before this.
+ * until_cell		The cell UNTIL_POINTER and UNTIL_VALUE watch
+ * until_value		The value UNTIL_VALUE waits for
+ *
+ * steps			The number of instructions executed since the last reset
+ * output_bytes		The number of bytes output since the last reset
+ * idle_time		Time (in ns) the interpreter thread has spent without
+ * 					anything to execute
+ * step_limit		The interpreter will not execute past this many steps. Used
+ * 					to keep replays in lockstep with their journal. UINT64_MAX
+ * 					means no limit.
+ * paused_at		The step the interpreter thread was on when it last saw
+ * 					stop_after at 0. It runs on to the end of a batch after the
+ * 					UI pauses it, so the UI sets this to UINT64_MAX when it
+ * 					pauses and waits for it to say where the pause took effect.
+ *
+ * instructionQueue	A queue containing instructions which have not yet been
+ * 					moved into the program
+ *
+ * program			The instructions received so far. Instructions are moved
+ * 					here from instructionQueue as the interpreter reaches them,
+ * 					so that loops can jump back to them. Only the eight
+ * 					brainfuck instructions are stored; a # sets a breakpoint
+ * 					on the instruction after it instead.
+ * program_length	The number of instructions in program
+ * ip				The index in program of the next instruction to execute
+ * status			Why the interpreter last stopped
+ *
+ * _program_capacity	The allocated size of program and the arrays which run
+ * 					alongside it
+ * _jumps			For each bracket in program, the index of its partner, or
+ * 					SIZE_MAX if its partner hasn't been received yet
+ * _open			Stack of the indices of the unmatched [s in program
+ * _open_length		The number of entries in _open
+ * _open_capacity	The allocated size of _open
+ *
+ * _breaks			For each instruction in program, whether it has a
+ * 					breakpoint
+ * _break_count		The number of breakpoints in program
+ * _break_next		Whether the next instruction loaded gets a breakpoint
+ * _at_break		Whether the interpreter is stopped at a breakpoint, which
+ * 					shouldn't fire again when it resumes
+ *
+ * _heat			For each [ in program, how many times its loop has jumped
+ * 					back
+ * _compiled		For each [ in program, its loop compiled to ops, or NULL
+ * _tier			Compiles hot loops in the background
  *
  * output			The StringCassette to which program output will be written
+ *
+ * input			The source from which , reads bytes
+ * eof_behaviour	What , does to the current cell once input is exhausted
+ *
+ * trace			The execution trace being recorded, or NULL
+ *
+ * snapshot			Consistent copies of the VM's state, published by the
+ * 					interpreter thread for the UI to render
+ * summary			An index of where the non-zero cells on the tape are.
+ * 					Only the interpreter thread uses it.
  */
 struct BrainfuckVM {
 	thrd_t interpreter_thread;
@@ -39,17 +149,204 @@ struct BrainfuckVM {
 
 	_Atomic int stop_after;
 	struct timespec tick_delay;
+	_Atomic bool skip_delay;
 	_Atomic bool die;
 
+	_Atomic int until;
+	_Atomic size_t until_cell;
+	_Atomic uintmax_t until_value;
+
+	_Atomic uint64_t steps;
+	_Atomic uint64_t output_bytes;
+	_Atomic uint64_t idle_time;
+	_Atomic uint64_t step_limit;
+	_Atomic uint64_t paused_at;
+
 	Queue instructionQueue;
 
+	char *program;
+	size_t program_length;
+	size_t ip;
+	enum InterpreterStatus status;
+
+	size_t _program_capacity;
+	size_t *_jumps;
+	size_t *_open;
+	size_t _open_length;
+	size_t _open_capacity;
+
+	bool *_breaks;
+	size_t _break_count;
+	bool _break_next;
+	bool _at_break;
+
+	uint32_t *_heat;
+	Program **_compiled;
+	Tier _tier;
+
 	StringCassette output;
+
+	InputSource input;
+	enum EOFBehaviour eof_behaviour;
+
+	Trace *trace;
+
+	Snapshot snapshot;
+	Summary summary;
 };
 
+/*
+ * Returns a mask of the bits of a uintmax_t which fit in a cell
+ */
+#define VM_CELL_MASK(vm) (((vm)->cell_size >= sizeof(uintmax_t)) \
+	? UINTMAX_MAX : (((uintmax_t)1 << ((vm)->cell_size * 8)) - 1))
+
+/*
+ * Reads a cell stored at p. Cells are stored in the host's byte order.
+ *
+ * p			The cell's first byte
+ * cell_size	The size of the cell in bytes
+ */
+static inline uintmax_t load_cell(const uint8_t *p, size_t cell_size) {
+	switch (cell_size) {
+		// fixed size copies compile down to single loads
+		case 1: return *p;
+		case 2: { uint16_t v; memcpy(&v, p, 2); return v; }
+		case 4: { uint32_t v; memcpy(&v, p, 4); return v; }
+		case 8: { uint64_t v; memcpy(&v, p, 8); return v; }
+		default: {
+			uintmax_t v = 0;
+			memcpy(&v, p, cell_size);
+			return v;
+		}
+	}
+}
+
+/*
+ * Reads the value of a cell.
+ *
+ * vm		The VM to read from
+ * i		The index of the cell
+ */
+static inline uintmax_t vm_get_cell(const struct BrainfuckVM *vm, size_t i) {
+	return load_cell(vm->tape + i * vm->cell_size, vm->cell_size);
+}
+
+/*
+ * Writes the value of a cell, and marks it as changed in the VM's summary.
+ * The value must already fit in a cell.
+ *
+ * vm		The VM to write to
+ * i		The index of the cell
+ * value	The value to write
+ */
+static inline void vm_set_cell(struct BrainfuckVM *vm, size_t i, uintmax_t value) {
+	uint8_t *p = vm->tape + i * vm->cell_size;
+
+	Summary_touch(&vm->summary, i);
+
+	switch (vm->cell_size) {
+		case 1: *p = value; break;
+		case 2: { uint16_t v = value; memcpy(p, &v, 2); break; }
+		case 4: { uint32_t v = value; memcpy(p, &v, 4); break; }
+		case 8: { uint64_t v = value; memcpy(p, &v, 8); break; }
+		default: memcpy(p, &value, vm->cell_size); break;
+	}
+}
+
 #ifndef _NOEXTERN
 extern struct BrainfuckVM bfvm;
 #endif  // _NOEXTERN
 
+/*
+ * Appends instructions to a VM's program. Characters which aren't brainfuck
+ * instructions are dropped. This must only be called from the interpreter
+ * thread, or while the interpreter thread isn't running.
+ *
+ * vm		The VM to load into
+ * n		The length of src
+ * src		The source code to append
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int interpreter_load(struct BrainfuckVM *vm, size_t n, const char *src);
+
+/*
+ * Makes room for n more instructions in a VM's program, along with the arrays
+ * which run alongside it. The new entries of _breaks, _heat and _compiled
+ * start out zeroed.
+ *
+ * vm		The VM to grow
+ * n		The number of instructions to make room for
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int interpreter_reserve(struct BrainfuckVM *vm, size_t n);
+
+/*
+ * Frees a VM's program.
+ *
+ * vm		The VM to unload
+ */
+void interpreter_unload(struct BrainfuckVM *vm);
+
+/*
+ * Resets a VM to the start of its program, with a clear tape and no output.
+ * The program, its breakpoints and its compiled loops are kept. The
+ * interpreter thread must not be running.
+ *
+ * vm		The VM to reset
+ */
+void interpreter_reset(struct BrainfuckVM *vm);
+
+/*
+ * Sets or clears the breakpoint on an instruction. Compiled loops around a
+ * new breakpoint are dropped, so that it fires. The interpreter thread must
+ * not be running.
+ *
+ * vm		The VM
+ * i		The index of the instruction in the program
+ * on		Whether the instruction gets a breakpoint
+ *
+ * Returns 0 on success. Returns -1 and sets errno to EINVAL if there is no
+ * such instruction.
+ */
+int interpreter_set_break(struct BrainfuckVM *vm, size_t i, bool on);
+
+/*
+ * Executes up to n instructions on the calling thread. This stops early if
+ * the program runs out of instructions, has to wait for input or reaches a
+ * breakpoint, in which case vm->status says why.
+ *
+ * Loops which run often are compiled in the background and then run as ops
+ * instead. This is invisible from the outside: execution still stops at
+ * exactly n instructions, and loops containing breakpoints are never
+ * compiled. The same goes for vm->until, which stops execution right after
+ * the instruction that gets there.
+ *
+ * vm		The VM to run
+ * n		The maximum number of instructions to execute
+ *
+ * Returns the number of instructions executed.
+ */
+size_t interpreter_run(struct BrainfuckVM *vm, size_t n);
+
+/*
+ * Runs the part of a VM's program which doesn't depend on its input, so that
+ * it can start from there: everything up to the first , or breakpoint, or the
+ * end of the program, for at most budget instructions. Getting to the input
+ * doesn't pause the VM. The interpreter thread must not be running.
+ *
+ * vm		The VM to run, which must have just been loaded or reset
+ * budget	The most instructions to run
+ *
+ * Returns the number of instructions executed.
+ */
+size_t interpreter_prefix(struct BrainfuckVM *vm, size_t budget);
+
+/*
+ * The interpreter thread. arg is the struct BrainfuckVM to run.
+ */
 int interpreter_thread(void *arg);
 
 #endif  // _INTERPRETER_H_
@@ -0,0 +1,161 @@
+#ifndef _JOURNAL_H_
+#define _JOURNAL_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define JOURNAL_MAGIC	"BFDJ"
+#define JOURNAL_VERSION	2
+
+// Largest batch of instructions which is coalesced before being written
+#define JOURNAL_BATCH_SIZE	4096
+
+/*
+ * The kinds of event stored in a journal
+ *
+ * JOURNAL_BATCH		Instructions were dispatched to the interpreter
+ * JOURNAL_PAUSE		The interpreter was paused
+ * JOURNAL_RESUME		The interpreter was resumed
+ * JOURNAL_RESET		The VM was reset
+ * JOURNAL_INPUT		Bytes were typed as program input
+ * JOURNAL_INPUT_EOF	The end of the program input was signalled
+ */
+enum JournalEventType {
+	JOURNAL_BATCH = 1,
+	JOURNAL_PAUSE,
+	JOURNAL_RESUME,
+	JOURNAL_RESET,
+	JOURNAL_INPUT,
+	JOURNAL_INPUT_EOF
+};
+
+/*
+ * The VM settings a journal was recorded with. A replay must use the same
+ * settings to be deterministic.
+ */
+struct JournalHeader {
+	uint64_t cell_size;
+	uint64_t tape_size;
+	uint64_t output_tape_size;
+	uint64_t eof_behaviour;
+	bool start_paused;
+};
+
+/*
+ * A single event in a journal.
+ *
+ * type		The kind of event
+ * time		Microseconds since the start of the recording
+ * steps	The number of instructions the VM had executed when the event
+ * 			occured
+ * length	The length of data
+ * data		The instructions or input bytes, for JOURNAL_BATCH and
+ * 			JOURNAL_INPUT. When reading a journal this points into the
+ * 			journal's memory and remains valid until the journal is closed.
+ */
+struct JournalEvent {
+	enum JournalEventType type;
+	uint64_t time;
+	uint64_t steps;
+	size_t length;
+	const char *data;
+};
+
+/*
+ * A journal of an interactive session, either being recorded or replayed.
+ *
+ * Every record is a type byte followed by LEB128 varints for the time since
+ * the previous record and the step count, then (for batches and input) a
+ * varint length and the data itself. Consecutive instructions dispatched at
+ * the same step are coalesced into one batch.
+ *
+ * _fp			The file being recorded to, or NULL when replaying
+ * _start		Monotonic time (in microseconds) the recording started at
+ * _last_time	The timestamp of the last record written or read
+ *
+ * _batch		Instructions waiting to be written as a single batch
+ * _batch_length	The number of instructions in _batch
+ * _batch_time	The time of the first instruction in _batch
+ * _batch_steps	The step count the instructions in _batch were dispatched at
+ *
+ * _data		The mapping of the journal being replayed
+ * _length		The size of _data
+ * _pos			Offset of the next record in _data
+ */
+typedef struct {
+	FILE *_fp;
+	uint64_t _start;
+	uint64_t _last_time;
+
+	char _batch[JOURNAL_BATCH_SIZE];
+	size_t _batch_length;
+	uint64_t _batch_time;
+	uint64_t _batch_steps;
+
+	const uint8_t *_data;
+	size_t _length;
+	size_t _pos;
+} Journal;
+
+/*
+ * Returns the current time in microseconds, for use as a journal timestamp.
+ */
+uint64_t Journal_now(void);
+
+/*
+ * Creates a journal file to record to.
+ *
+ * j		The journal to initialize
+ * path		The file to record to. It is truncated if it already exists.
+ * hdr		The VM settings to record
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int Journal_create(Journal *j, const char *path, const struct JournalHeader *hdr);
+
+/*
+ * Opens a journal file for replay.
+ *
+ * j		The journal to initialize
+ * path		The file to replay
+ * hdr		Filled with the VM settings the journal was recorded with
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure. errno is set
+ * to EINVAL if the file is not a journal.
+ */
+int Journal_open(Journal *j, const char *path, struct JournalHeader *hdr);
+
+/*
+ * Closes a journal, flushing anything which has not yet been written.
+ *
+ * j		The journal to close
+ */
+void Journal_close(Journal *j);
+
+/*
+ * Records an event, timestamped with the current time.
+ *
+ * j		The journal to record to
+ * type		The kind of event
+ * steps	The number of instructions the VM has executed
+ * n		The length of data
+ * data		The instructions or input bytes. May be NULL if n is 0.
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int Journal_record(Journal *j, enum JournalEventType type, uint64_t steps, size_t n, const char *data);
+
+/*
+ * Reads the next event from a journal being replayed.
+ *
+ * j		The journal to read from
+ * ev		Filled with the event
+ *
+ * Returns 1 if an event was read, 0 at the end of the journal, or -1 if the
+ * journal is corrupt.
+ */
+int Journal_next(Journal *j, struct JournalEvent *ev);
+
+#endif  // _JOURNAL_H_
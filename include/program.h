@@ -0,0 +1,122 @@
+#ifndef _PROGRAM_H_
+#define _PROGRAM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Flags for Program_compile
+#define PROGRAM_FOLD_RUNS	0x1  // Combine runs of +- and <> into single ops
+#define PROGRAM_FOLD_IDIOMS	0x2  // Replace clear, scan and multiply loops
+#define PROGRAM_OPTIMISE	(PROGRAM_FOLD_RUNS | PROGRAM_FOLD_IDIOMS)
+
+// Jump target of a [ which has no matching ]
+#define OP_UNMATCHED	UINT32_MAX
+
+/*
+ * The operations a program is compiled to
+ *
+ * OP_ADD		Adds arg to the current cell
+ * OP_MOVE		Moves the pointer arg cells (wrapping around the tape)
+ * OP_OUT		Outputs the current cell
+ * OP_IN		Reads into the current cell
+ * OP_JZ		[: jumps past op target if the current cell is zero. If target
+ * 				is OP_UNMATCHED the program halts here instead.
+ * OP_JNZ		]: jumps to the op after op target if the current cell is
+ * 				non-zero
+ * OP_NOP		An unmatched ], which does nothing
+ * OP_CLEAR		[-] or [+]. arg is the change made by the body (-1 or 1)
+ * OP_SCAN		A loop which only moves the pointer, e.g. [>] or [<<<].
+ * 				arg is the net movement of one iteration.
+ * OP_MULADD	A loop which moves the current cell's value into other cells,
+ * 				e.g. [->+>++<<]. arg is the change made to the current cell
+ * 				each iteration (-1 or 1) and target is the number of OP_TERMs
+ * 				which follow.
+ * OP_TERM		One destination of an OP_MULADD. Adds arg times the number of
+ * 				iterations to the cell offset cells away.
+ * OP_END		The end of the program
+ */
+enum OpType {
+	OP_ADD,
+	OP_MOVE,
+	OP_OUT,
+	OP_IN,
+	OP_JZ,
+	OP_JNZ,
+	OP_NOP,
+	OP_CLEAR,
+	OP_SCAN,
+	OP_MULADD,
+	OP_TERM,
+	OP_END
+};
+
+/*
+ * A single operation. The layout only uses fixed width types, so compiled
+ * programs can be written to disk as-is.
+ *
+ * type		An OpType
+ * steps	The number of source instructions this op stands for. For loop
+ * 			idioms this is the length of the loop body, as the number of
+ * 			steps they take depends on how many times they iterate.
+ * target	See OpType
+ * arg		See OpType
+ * offset	OP_TERM only. The offset of the destination cell.
+ * src		The index of this op's first instruction in the source. This is
+ * 			where the interpreter resumes if execution of the op form stops
+ * 			before this op.
+ */
+struct Op {
+	uint32_t type;
+	uint32_t steps;
+	uint32_t target;
+	uint32_t _reserved;
+	int64_t arg;
+	int64_t offset;
+	uint64_t src;
+};
+
+/*
+ * A program compiled to ops.
+ *
+ * ops			The ops. The last op is always OP_END.
+ * length		The number of ops
+ * source_length	The number of instructions in the source
+ * tape_size	The tape length the program was compiled for
+ * flags		The flags the program was compiled with
+ *
+ * _capacity	The allocated size of ops
+ */
+typedef struct {
+	struct Op *ops;
+	size_t length;
+	size_t source_length;
+	size_t tape_size;
+	unsigned flags;
+
+	size_t _capacity;
+} Program;
+
+/*
+ * Compiles brainfuck source to ops. Characters which aren't instructions are
+ * ignored, and do not count towards source indices.
+ *
+ * p			The program to initialize
+ * n			The length of src
+ * src			The source code
+ * tape_size	The length of the tape the program will run on. Multiply loops
+ * 				are only folded if none of their destinations wrap around
+ * 				onto the loop's own cell.
+ * flags		PROGRAM_* flags selecting which optimisations to apply
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int Program_compile(Program *p, size_t n, const char *src, size_t tape_size, unsigned flags);
+
+/*
+ * Frees a compiled program.
+ *
+ * p		The program to free
+ */
+void Program_free(Program *p);
+
+#endif  // _PROGRAM_H_
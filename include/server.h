@@ -0,0 +1,236 @@
+#ifndef _SERVER_H_
+#define _SERVER_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "interpreter.h"
+
+// Bump this whenever the protocol changes
+#define SERVER_VERSION	1
+
+// Most clients connected at once
+#define SERVER_MAX_CLIENTS	16
+
+// Largest payload a request may carry
+#define SERVER_MAX_PAYLOAD	((uint64_t)1 << 28)
+
+// Most replies and events queued for a client which isn't reading them before
+// it is disconnected
+#define SERVER_MAX_BACKLOG	((size_t)1 << 28)
+
+// Number of instructions run between checks for requests while running
+#define SERVER_RUN_BATCH	(1 << 20)
+
+/*
+ * The debug server protocol
+ *
+ * Clients talk to the server over a Unix stream socket. Every message in
+ * either direction is a ServerFrame followed by length bytes of payload.
+ * Numbers are uint64_t in the host's byte order, as both ends are on the same
+ * machine.
+ *
+ * Each request is answered by a SERVER_REPLY or SERVER_ERROR carrying its id,
+ * in the order the requests were sent. Requests can be sent without waiting
+ * for the replies to earlier ones; everything which has arrived is handled
+ * in one go and the replies are written back together, so a batch of
+ * requests costs a single round trip. At most one largest possible request's
+ * worth is buffered from a client at a time.
+ *
+ * SERVER_OUTPUT and SERVER_STOPPED events are sent to every client as they
+ * happen, with an id of 0 and the id of the SERVER_RUN respectively.
+ */
+struct ServerFrame {
+	uint8_t type;
+	uint8_t flags;
+	uint16_t reserved;
+	uint32_t id;
+	uint64_t length;
+};
+
+/*
+ * Requests, with their payloads and replies
+ *
+ * SERVER_STATE		Empty. Replies with a ServerState.
+ * SERVER_LOAD		Source code, which is appended to the program. With
+ * 					SERVER_LOAD_REPLACE the old program is unloaded and the VM
+ * 					reset first. Replies with a ServerState.
+ * SERVER_RESET		Empty. Resets the VM, keeping the program. Replies with a
+ * 					ServerState.
+ * SERVER_RUN		Optionally the most instructions to run (0 for no limit),
+ * 					then optionally a RunUntil, a cell and a value to run
+ * 					until. Replies straight away; the run goes on in the
+ * 					background until it finishes or is paused, and then a
+ * 					SERVER_STOPPED event is sent.
+ * SERVER_STEP		Optionally the number of instructions to run, which
+ * 					defaults to 1. Replies with a ServerState once they have
+ * 					run.
+ * SERVER_PAUSE		Empty. Stops a run. Replies with a ServerState.
+ * SERVER_BREAK		Instruction indices to set breakpoints on, or to clear them
+ * 					from with SERVER_BREAK_CLEAR. Replies with the number of
+ * 					breakpoints.
+ * SERVER_BREAKS	Empty. Replies with the index of every instruction which
+ * 					has a breakpoint.
+ * SERVER_READ		Pairs of a first cell and a number of cells. Replies with
+ * 					the cells in each range one after another, each cell_size
+ * 					bytes in the host's byte order.
+ * SERVER_INPUT		Bytes for the program's input. With SERVER_INPUT_EOF the
+ * 					input is then closed. Replies with nothing.
+ * SERVER_QUIT		Empty. Replies with nothing, then shuts the server down.
+ *
+ * SERVER_LOAD, SERVER_RESET and SERVER_STEP fail with EBUSY during a run.
+ */
+enum ServerRequest {
+	SERVER_STATE = 1,
+	SERVER_LOAD,
+	SERVER_RESET,
+	SERVER_RUN,
+	SERVER_STEP,
+	SERVER_PAUSE,
+	SERVER_BREAK,
+	SERVER_BREAKS,
+	SERVER_READ,
+	SERVER_INPUT,
+	SERVER_QUIT
+};
+
+// Request flags
+#define SERVER_LOAD_REPLACE	0x1
+#define SERVER_BREAK_CLEAR	0x1
+#define SERVER_INPUT_EOF	0x1
+
+/*
+ * Messages from the server
+ *
+ * SERVER_REPLY		A request succeeded. The payload depends on the request.
+ * SERVER_ERROR		A request failed. The payload is an errno value followed by
+ * 					a description.
+ * SERVER_OUTPUT	The program wrote output. The payload is the number of
+ * 					bytes which were lost because more was written than the
+ * 					output tape holds, followed by the bytes themselves.
+ * SERVER_STOPPED	A run finished. The payload is a ServerState.
+ */
+enum ServerMessage {
+	SERVER_REPLY = 0x80,
+	SERVER_ERROR,
+	SERVER_OUTPUT,
+	SERVER_STOPPED
+};
+
+/*
+ * The state of the VM, as sent to clients
+ *
+ * version			SERVER_VERSION
+ * cell_size		The VM's cell size in bytes
+ * tape_size		The length of the tape
+ * program_length	The number of instructions loaded
+ * ip				The index of the next instruction
+ * current_cell		The cell the pointer is on
+ * steps			The number of instructions executed since the last reset
+ * output_bytes		The number of bytes output since the last reset
+ * status			An InterpreterStatus saying why the VM last stopped
+ * running			Whether a run is going on
+ */
+struct ServerState {
+	uint64_t version;
+	uint64_t cell_size;
+	uint64_t tape_size;
+	uint64_t program_length;
+	uint64_t ip;
+	uint64_t current_cell;
+	uint64_t steps;
+	uint64_t output_bytes;
+	uint64_t status;
+	uint64_t running;
+};
+
+/*
+ * A connected client
+ *
+ * fd			The client's socket, or -1 if this slot is free
+ * dead			Whether the client is to be disconnected
+ * in			Bytes received which don't make a whole request yet
+ * out			Bytes waiting to be sent, from out_start
+ */
+struct ServerClient {
+	int fd;
+	bool dead;
+
+	uint8_t *in;
+	size_t in_length;
+	size_t in_capacity;
+
+	uint8_t *out;
+	size_t out_start;
+	size_t out_length;
+	size_t out_capacity;
+};
+
+/*
+ * A debug server, which runs a VM on behalf of clients connected to a Unix
+ * socket. The VM is run on the thread which calls Server_run, so the
+ * interpreter thread must not be started.
+ *
+ * _path		The path of the socket
+ * _listen		The listening socket
+ * _wake		A pipe which Server_wake writes to, to interrupt a poll
+ * _clients		The connected clients
+ *
+ * _running		Whether a run is going on
+ * _run_id		The id of the request which started it
+ * _run_left	The most instructions left to run, or UINT64_MAX
+ * _output_sent	How much of the VM's output has been sent to clients
+ * _quit		Whether a client has asked the server to shut down
+ */
+typedef struct {
+	char *_path;
+	int _listen;
+	int _wake[2];
+	struct ServerClient _clients[SERVER_MAX_CLIENTS];
+
+	bool _running;
+	uint32_t _run_id;
+	uint64_t _run_left;
+	uint64_t _output_sent;
+	bool _quit;
+} Server;
+
+/*
+ * Creates a server listening on a Unix socket. A socket left over at path
+ * from an earlier server is replaced.
+ *
+ * s		The server to initialize
+ * path		Where to create the socket
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int Server_open(Server *s, const char *path);
+
+/*
+ * Serves clients until one of them sends SERVER_QUIT or vm->die is set.
+ *
+ * s		The server
+ * vm		The VM to control. It must be set up and have its program loaded,
+ * 			if there is one.
+ *
+ * Returns 0 when told to stop. Returns -1 and sets errno on failure.
+ */
+int Server_run(Server *s, struct BrainfuckVM *vm);
+
+/*
+ * Wakes a server waiting for clients, so that it notices vm->die has been
+ * set. This is safe to call from a signal handler.
+ *
+ * s		The server
+ */
+void Server_wake(Server *s);
+
+/*
+ * Disconnects every client and removes the socket.
+ *
+ * s		The server to close
+ */
+void Server_close(Server *s);
+
+#endif  // _SERVER_H_
@@ -0,0 +1,180 @@
+#ifndef _SNAPSHOT_H_
+#define _SNAPSHOT_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Most cells a snapshot's tape window can hold
+#define SNAPSHOT_MAX_CELLS	8192
+
+// Most output bytes a snapshot holds
+#define SNAPSHOT_OUTPUT_TAIL	4096
+
+// Most columns a snapshot's minimap can have
+#define SNAPSHOT_MINIMAP_MAX	256
+
+/*
+ * Searches of the tape the UI can ask the interpreter thread to run
+ *
+ * SNAPSHOT_QUERY_NEXT	Finds the first non-zero cell at or after a cell
+ * SNAPSHOT_QUERY_PREV	Finds the last non-zero cell before a cell
+ * SNAPSHOT_QUERY_FIND	Finds the first cell at or after a cell holding a
+ * 						value
+ *
+ * Searches wrap around the ends of the tape.
+ */
+enum SnapshotQuery {
+	SNAPSHOT_QUERY_NEXT = 1,
+	SNAPSHOT_QUERY_PREV,
+	SNAPSHOT_QUERY_FIND
+};
+
+/*
+ * A consistent copy of the parts of the VM the UI shows.
+ *
+ * valid			False until the first snapshot has been published
+ * steps			The VM's step count when the snapshot was taken
+ * current_cell		The index of the current cell
+ * window_start		The index of the first cell in window
+ * window_cells		The number of cells in window
+ * window			A copy of the cells in the tape window, cell_size bytes each
+ * output_length	The number of bytes in output
+ * output			The last bytes of program output, oldest first
+ * minimap_length	The number of columns in minimap
+ * minimap			How full each 1/minimap_length of the tape is, from 0
+ * 					(all zero) to 255 (all non-zero). Columns holding any
+ * 					non-zero cells are at least 1.
+ * query			The number of the last search which has been answered
+ * query_result		The cell that search found, or SIZE_MAX
+ */
+struct SnapshotFrame {
+	bool valid;
+	uint64_t steps;
+	size_t current_cell;
+
+	size_t window_start;
+	size_t window_cells;
+	uint8_t *window;
+
+	size_t output_length;
+	char *output;
+
+	size_t minimap_length;
+	uint8_t minimap[SNAPSHOT_MINIMAP_MAX];
+
+	unsigned query;
+	size_t query_result;
+};
+
+/*
+ * Snapshots of the VM passed from the interpreter thread to the UI thread
+ * through a triple buffer. The interpreter fills in the back frame and swaps
+ * it with the middle one; the UI swaps the middle frame with the front one
+ * whenever a newer frame is waiting. Neither side ever waits for the other,
+ * and each side only ever touches frames the other can't see.
+ *
+ * _frames			The three frames
+ * _front			The frame the UI is reading. Only the UI uses this.
+ * _back			The frame the interpreter is filling in. Only the
+ * 					interpreter uses this.
+ * _middle			The frame in between. SNAPSHOT_FRESH is set if the UI
+ * 					hasn't seen it yet.
+ * _window_start	The first cell the UI wants to see
+ * _window_cells	The number of cells the UI wants to see
+ * _minimap_length	The number of minimap columns the UI wants
+ * _max_cells		The number of cells each frame's window can hold
+ *
+ * _query			The number of the last search the UI asked for
+ * _query_type		The SnapshotQuery to run
+ * _query_from		The cell to search from
+ * _query_value		The value to search for
+ */
+typedef struct {
+	struct SnapshotFrame _frames[3];
+	unsigned _front;
+	unsigned _back;
+	_Atomic unsigned _middle;
+
+	_Atomic size_t _window_start;
+	_Atomic size_t _window_cells;
+	_Atomic size_t _minimap_length;
+	size_t _max_cells;
+
+	_Atomic unsigned _query;
+	_Atomic int _query_type;
+	_Atomic size_t _query_from;
+	_Atomic uintmax_t _query_value;
+} Snapshot;
+
+// Set in Snapshot._middle when it holds a frame the UI hasn't read
+#define SNAPSHOT_FRESH	0x4
+
+/*
+ * Initializes a snapshot buffer.
+ *
+ * s			The snapshot buffer to initialize
+ * cell_size	The size of each cell in bytes
+ * max_cells	The most cells the tape window can hold
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int Snapshot_init(Snapshot *s, size_t cell_size, size_t max_cells);
+
+/*
+ * Frees a snapshot buffer.
+ *
+ * s		The snapshot buffer to free
+ */
+void Snapshot_free(Snapshot *s);
+
+/*
+ * Sets which cells the UI wants to see. This is picked up by the next
+ * snapshot to be published. Only call this from the UI thread.
+ *
+ * s		The snapshot buffer
+ * start	The index of the first cell
+ * cells	The number of cells. This is clamped to the window's capacity.
+ * minimap	The number of minimap columns. This is clamped to
+ * 			SNAPSHOT_MINIMAP_MAX.
+ */
+void Snapshot_request(Snapshot *s, size_t start, size_t cells, size_t minimap);
+
+/*
+ * Asks the interpreter thread to search the tape. The answer turns up in a
+ * later snapshot, once its query matches the number returned. Asking again
+ * before then replaces the search. Only call this from the UI thread.
+ *
+ * s		The snapshot buffer
+ * type		What to search for
+ * from		The cell to search from
+ * value	The value to search for, for SNAPSHOT_QUERY_FIND
+ *
+ * Returns the number of the search.
+ */
+unsigned Snapshot_query(Snapshot *s, enum SnapshotQuery type, size_t from, uintmax_t value);
+
+/*
+ * Returns the frame to fill in with the next snapshot. Only call this from
+ * the interpreter thread.
+ */
+#define Snapshot_begin(s) (&(s)->_frames[(s)->_back])
+
+/*
+ * Publishes the frame returned by Snapshot_begin. Only call this from the
+ * interpreter thread.
+ *
+ * s		The snapshot buffer
+ */
+void Snapshot_commit(Snapshot *s);
+
+/*
+ * Returns the newest published snapshot. The frame remains valid until the
+ * next call. Only call this from the UI thread.
+ *
+ * s		The snapshot buffer
+ */
+const struct SnapshotFrame *Snapshot_read(Snapshot *s);
+
+#endif  // _SNAPSHOT_H_
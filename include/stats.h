@@ -0,0 +1,86 @@
+#ifndef _STATS_H_
+#define _STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "interpreter.h"
+#include "ui.h"
+
+// How often (in us) the statistics are sampled
+#define STATS_INTERVAL	1000000
+
+// Maximum number of panes whose render times are tracked
+#define STATS_MAX_PANES	8
+
+/*
+ * A sample of the runtime statistics. Rates are averaged over the time since
+ * the previous sample.
+ *
+ * time					When the sample was taken (monotonic, in us)
+ *
+ * steps				Instructions executed since the last reset
+ * steps_per_sec		Instructions executed per second
+ * queue_depth			Instructions waiting in the instruction queue
+ * output_bytes			Bytes output since the last reset
+ * output_per_sec		Bytes output per second
+ * idle					The fraction of time the interpreter thread had nothing
+ * 						to execute
+ *
+ * frame_time			Time (in us) taken to render the last frame
+ * frame_budget			Time (in us) available to render each frame
+ * pane_count			The number of panes below
+ * pane_titles			The title of each pane
+ * pane_render_times	Time (in us) taken to render each pane last frame
+ *
+ * _idle_time			The VM's idle time counter when the sample was taken
+ */
+struct Stats {
+	uint64_t time;
+
+	uint64_t steps;
+	double steps_per_sec;
+	size_t queue_depth;
+	uint64_t output_bytes;
+	double output_per_sec;
+	double idle;
+
+	uint64_t frame_time;
+	uint64_t frame_budget;
+	size_t pane_count;
+	const char *pane_titles[STATS_MAX_PANES];
+	uint64_t pane_render_times[STATS_MAX_PANES];
+
+	uint64_t _idle_time;
+};
+
+#ifndef _NOEXTERN
+extern struct Stats stats;
+#endif  // _NOEXTERN
+
+/*
+ * Returns the monotonic time in microseconds
+ */
+uint64_t Stats_now(void);
+
+/*
+ * Takes a new sample of the statistics.
+ *
+ * s			The statistics to update. The previous sample is used to
+ * 				calculate rates.
+ * vm			The VM to sample
+ * panes		NULL terminated list of the UI's panes
+ * frame_budget	Time (in us) available to render each frame
+ */
+void Stats_sample(struct Stats *s, struct BrainfuckVM *vm, Pane **panes, uint64_t frame_budget);
+
+/*
+ * Writes a sample as a single line of JSON.
+ *
+ * s		The sample to write
+ * fp		The file to write to
+ */
+void Stats_write_json(const struct Stats *s, FILE *fp);
+
+#endif  // _STATS_H_
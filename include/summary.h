@@ -0,0 +1,148 @@
+#ifndef _SUMMARY_H_
+#define _SUMMARY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Cells per summary block (a power of two)
+#define SUMMARY_BLOCK_SHIFT	10
+#define SUMMARY_BLOCK_CELLS	((size_t)1 << SUMMARY_BLOCK_SHIFT)
+
+/*
+ * A summary of a memory tape which answers questions like "where is the next
+ * non-zero cell?" without reading the whole tape.
+ *
+ * The tape is split into blocks of SUMMARY_BLOCK_CELLS cells. A segment tree
+ * over the blocks stores how many non-zero cells each subtree holds and the
+ * largest value in it, so searches can skip whole runs of blocks at a time.
+ * Writes to the tape only mark their block as dirty; dirty blocks are
+ * re-counted when the summary is refreshed.
+ *
+ * tape_size	The length of the tape in cells
+ * cell_size	The size of each cell in bytes
+ * blocks		The number of blocks
+ *
+ * _leaves		The number of leaves in the tree, a power of two
+ * _count		The number of non-zero cells under each node. Node 1 is the
+ * 				root, node n's children are 2n and 2n+1, and block b is node
+ * 				_leaves+b.
+ * _max			The largest value under each node
+ * _dirty		Whether each block has been written since it was counted
+ * _dirty_list	The indices of the dirty blocks
+ * _dirty_length	The number of entries in _dirty_list
+ */
+typedef struct {
+	size_t tape_size;
+	size_t cell_size;
+	size_t blocks;
+
+	size_t _leaves;
+	uint64_t *_count;
+	uintmax_t *_max;
+	bool *_dirty;
+	size_t *_dirty_list;
+	size_t _dirty_length;
+} Summary;
+
+/*
+ * Initializes the summary of an all zero tape.
+ *
+ * s			The summary to initialize
+ * tape_size	The length of the tape in cells
+ * cell_size	The size of each cell in bytes
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int Summary_init(Summary *s, size_t tape_size, size_t cell_size);
+
+/*
+ * Frees a summary.
+ *
+ * s		The summary to free
+ */
+void Summary_free(Summary *s);
+
+/*
+ * Resets a summary after its tape has been cleared.
+ *
+ * s		The summary to reset
+ */
+void Summary_clear(Summary *s);
+
+/*
+ * Marks a cell as written. This is called for every write to the tape, so it
+ * has to stay cheap.
+ *
+ * s		The summary
+ * cell		The index of the cell
+ */
+static inline void Summary_touch(Summary *s, size_t cell) {
+	const size_t b = cell >> SUMMARY_BLOCK_SHIFT;
+
+	if (!s->_dirty[b]) {
+		s->_dirty[b] = true;
+		s->_dirty_list[s->_dirty_length++] = b;
+	}
+}
+
+/*
+ * Re-counts dirty blocks.
+ *
+ * s			The summary
+ * tape			The tape
+ * max_blocks	The most blocks to re-count. Any others stay dirty.
+ */
+void Summary_refresh(Summary *s, const uint8_t *tape, size_t max_blocks);
+
+/*
+ * Counts the non-zero cells in the blocks overlapping a range of cells, as of
+ * the last refresh.
+ *
+ * s		The summary
+ * lo		The first cell in the range
+ * hi		One past the last cell in the range
+ * cells	Set to the number of cells in the blocks counted
+ *
+ * Returns the number of non-zero cells.
+ */
+uint64_t Summary_count(const Summary *s, size_t lo, size_t hi, uint64_t *cells);
+
+/*
+ * Finds the first non-zero cell at or after a cell. The summary should be
+ * refreshed first.
+ *
+ * s		The summary
+ * tape		The tape
+ * from		The cell to start searching from
+ *
+ * Returns the index of the cell, or SIZE_MAX if there isn't one.
+ */
+size_t Summary_next_nonzero(const Summary *s, const uint8_t *tape, size_t from);
+
+/*
+ * Finds the last non-zero cell before a cell. The summary should be refreshed
+ * first.
+ *
+ * s		The summary
+ * tape		The tape
+ * from		The cell to search back from. This cell isn't checked.
+ *
+ * Returns the index of the cell, or SIZE_MAX if there isn't one.
+ */
+size_t Summary_prev_nonzero(const Summary *s, const uint8_t *tape, size_t from);
+
+/*
+ * Finds the first cell at or after a cell which holds a value. The summary
+ * should be refreshed first.
+ *
+ * s		The summary
+ * tape		The tape
+ * from		The cell to start searching from
+ * value	The value to search for
+ *
+ * Returns the index of the cell, or SIZE_MAX if there isn't one.
+ */
+size_t Summary_find(const Summary *s, const uint8_t *tape, size_t from, uintmax_t value);
+
+#endif  // _SUMMARY_H_
@@ -0,0 +1,61 @@
+#ifndef _TAPE_H_
+#define _TAPE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Bulk operations on a memory tape. Scans and comparisons have SSE2 and AVX2
+ * kernels, which are picked at runtime on x86, and a scalar fallback
+ * everywhere else.
+ */
+
+/*
+ * Runs the search done by a scan loop such as [>] or [<<<]. Starting from
+ * the cell after *cell, cells are visited stride cells apart, wrapping around
+ * the ends of the tape, until a zero cell is found.
+ *
+ * tape			The memory tape
+ * tape_size	The length of the tape in cells
+ * cell_size	The size of each cell in bytes
+ * cell			The cell the scan starts from, which is not checked itself.
+ * 				Set to the zero cell found, or to the last cell visited if
+ * 				the scan gave up.
+ * stride		The distance between visited cells. Negative strides move
+ * 				towards the start of the tape.
+ * iterations	The maximum number of strides to take. Set to the number of
+ * 				strides actually taken.
+ *
+ * Returns true if a zero cell was found.
+ */
+bool tape_scan(const uint8_t *tape, size_t tape_size, size_t cell_size,
+			   size_t *cell, ssize_t stride, uint64_t *iterations);
+
+/*
+ * Compares two blocks of memory.
+ *
+ * a		The first block
+ * b		The second block
+ * n		The size of the blocks in bytes
+ *
+ * Returns the offset of the first byte which differs, or n if the blocks are
+ * identical.
+ */
+size_t tape_compare(const uint8_t *a, const uint8_t *b, size_t n);
+
+/*
+ * Zeroes a block of memory.
+ *
+ * tape		The block to zero
+ * n		The size of the block in bytes
+ */
+void tape_clear(uint8_t *tape, size_t n);
+
+/*
+ * Returns the name of the kernels in use ("avx2", "sse2" or "scalar")
+ */
+const char *tape_kernel(void);
+
+#endif  // _TAPE_H_
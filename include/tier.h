@@ -0,0 +1,108 @@
+#ifndef _TIER_H_
+#define _TIER_H_
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <threads.h>
+
+#include "program.h"
+
+// Number of times a loop has to jump back before it is compiled
+#define TIER_THRESHOLD	1000
+
+// The PROGRAM_* flags hot loops are compiled with
+#define TIER_FLAGS	PROGRAM_OPTIMISE
+
+/*
+ * A loop waiting to be compiled, or which has been compiled.
+ *
+ * open		The index of the loop's [ in the VM's program
+ * length	The length of src
+ * src		A copy of the loop's instructions, from its [ to its ]
+ * result	What Program_compile returned
+ * program	The compiled loop. Op sources are relative to open.
+ *
+ * _next	The next job in the list
+ */
+typedef struct TierJob {
+	size_t open;
+	size_t length;
+	char *src;
+	int result;
+	Program program;
+
+	struct TierJob *_next;
+} TierJob;
+
+/*
+ * A compiler thread which compiles hot loops in the background, so that the
+ * interpreter can carry on interpreting them in the meantime.
+ *
+ * _thread		The compiler thread, started by the first request
+ * _lock		Protects everything below
+ * _cond		Signalled when a job is requested or the thread should stop
+ * _started		Whether _thread is running
+ * _die			Tells the compiler thread to stop
+ * _pending		Jobs waiting to be compiled
+ * _done		Compiled jobs waiting to be collected
+ * _ready		Set when _done is non-empty, so it can be polled without
+ * 				taking the lock
+ */
+typedef struct {
+	thrd_t _thread;
+	mtx_t _lock;
+	cnd_t _cond;
+	bool _started;
+	bool _die;
+
+	TierJob *_pending;
+	TierJob *_done;
+	_Atomic bool _ready;
+} Tier;
+
+/*
+ * Queues a loop to be compiled.
+ *
+ * t			The tier
+ * open			The index of the loop's [
+ * n			The length of src
+ * src			The loop's instructions, from its [ to its ]. They are copied.
+ * tape_size	The length of the tape the loop will run on
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int Tier_request(Tier *t, size_t open, size_t n, const char *src, size_t tape_size);
+
+/*
+ * Returns true if there are compiled loops to collect. This doesn't take the
+ * tier's lock, so it is cheap enough to call often.
+ */
+#define Tier_ready(t) atomic_load_explicit(&(t)->_ready, memory_order_acquire)
+
+/*
+ * Takes the jobs which have finished compiling. The caller owns the returned
+ * jobs, and frees them with Tier_free_job.
+ *
+ * t		The tier
+ *
+ * Returns a list of jobs linked through _next, or NULL if there are none.
+ */
+TierJob *Tier_collect(Tier *t);
+
+/*
+ * Frees a job. The job's program is not freed.
+ *
+ * job		The job to free
+ */
+void Tier_free_job(TierJob *job);
+
+/*
+ * Stops the compiler thread and drops any jobs which haven't been collected.
+ * The tier can be used again afterwards.
+ *
+ * t		The tier
+ */
+void Tier_stop(Tier *t);
+
+#endif  // _TIER_H_
@@ -0,0 +1,155 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TRACE_MAGIC		"BFDT"
+#define TRACE_VERSION	1
+
+// Number of block records buffered before they are written out
+#define TRACE_BUFFER_RECORDS	65536
+
+// Packing of the ip and op into a single field of a TraceRecord
+#define TRACE_IP_BITS	56
+#define TRACE_IP(r)		((r)->ip_op & ((UINT64_C(1) << TRACE_IP_BITS) - 1))
+#define TRACE_OP(r)		((char)((r)->ip_op >> TRACE_IP_BITS))
+#define TRACE_IP_OP(ip, op)	((uint64_t)(ip) | ((uint64_t)(uint8_t)(op) << TRACE_IP_BITS))
+
+/*
+ * The header at the start of a trace file. All fields of a trace file are in
+ * the host's byte order.
+ *
+ * magic		TRACE_MAGIC
+ * version		TRACE_VERSION
+ * cell_size	The VM's cell size in bytes
+ * tape_size	The length of the VM's memory tape
+ */
+struct TraceHeader {
+	char magic[4];
+	uint16_t version;
+	uint16_t cell_size;
+	uint64_t tape_size;
+};
+
+/*
+ * The types of chunk which make up the body of a trace file. Every chunk
+ * starts with a TraceChunk header.
+ *
+ * TRACE_CHUNK_PROGRAM	count instructions were appended to the program
+ * TRACE_CHUNK_BLOCKS	count TraceRecords follow
+ * TRACE_CHUNK_RESET	The VM was reset. The program is kept.
+ * TRACE_CHUNK_UNLOAD	The program was unloaded. The instructions which
+ * 						follow make up a new one.
+ */
+enum TraceChunkType {
+	TRACE_CHUNK_PROGRAM = 1,
+	TRACE_CHUNK_BLOCKS,
+	TRACE_CHUNK_RESET,
+	TRACE_CHUNK_UNLOAD
+};
+
+struct TraceChunk {
+	uint32_t type;
+	uint32_t count;
+};
+
+/*
+ * The VM's state on entry to a basic block. Blocks start after every [ and ]
+ * (taken or not) and after every , so that the individual steps between two
+ * records can be reconstructed by simulating the instructions in between.
+ *
+ * step		The number of instructions executed before this one
+ * ip_op	The instruction pointer and the instruction it points to. Use
+ * 			TRACE_IP and TRACE_OP to unpack it.
+ * cell		The current cell index
+ * value	The value of the current cell
+ */
+struct TraceRecord {
+	uint64_t step;
+	uint64_t ip_op;
+	uint64_t cell;
+	uint64_t value;
+};
+
+/*
+ * An execution trace being written. A trace belongs to a single interpreter
+ * thread, which is the only thread that may write to it.
+ *
+ * _fp			The trace file
+ * _records		Buffered records which have not been written yet
+ * _length		The number of records in _records
+ */
+typedef struct {
+	FILE *_fp;
+
+	struct TraceRecord *_records;
+	size_t _length;
+} Trace;
+
+/*
+ * Creates a trace file.
+ *
+ * t			The trace to initialize
+ * path			The file to write. It is truncated if it already exists.
+ * cell_size	The VM's cell size
+ * tape_size	The VM's tape length
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int Trace_create(Trace *t, const char *path, size_t cell_size, size_t tape_size);
+
+/*
+ * Writes out buffered records and closes a trace.
+ *
+ * t		The trace to close
+ */
+void Trace_close(Trace *t);
+
+/*
+ * Writes out buffered records. This is the slow path of Trace_block and
+ * does not normally need to be called directly.
+ *
+ * t		The trace to flush
+ */
+void Trace_flush(Trace *t);
+
+/*
+ * Records instructions being appended to the program.
+ *
+ * t		The trace to record to
+ * n		The number of instructions
+ * program	The instructions
+ */
+void Trace_program(Trace *t, size_t n, const char *program);
+
+/*
+ * Records a VM reset.
+ *
+ * t		The trace to record to
+ */
+void Trace_reset(Trace *t);
+
+/*
+ * Records the program being unloaded.
+ *
+ * t		The trace to record to
+ */
+void Trace_unload(Trace *t);
+
+/*
+ * Records the VM's state on entry to a basic block.
+ */
+static inline void Trace_block(Trace *t, uint64_t step, size_t ip, char op, size_t cell, uintmax_t value) {
+	t->_records[t->_length++] = (struct TraceRecord){
+		.step = step,
+		.ip_op = TRACE_IP_OP(ip, op),
+		.cell = cell,
+		.value = value
+	};
+
+	if (t->_length == TRACE_BUFFER_RECORDS) Trace_flush(t);
+}
+
+#endif  // _TRACE_H_
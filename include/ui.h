@@ -1,11 +1,14 @@
 #ifndef _UI_H_
 #define _UI_H_
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 
 #include <ncurses.h>
 
+#define KEY_CTRL(key) ((key) & 0x1F)
+
 typedef struct Pane Pane;
 
 typedef void PaneRendererCb(Pane *);
@@ -23,6 +26,8 @@ struct Pane {
 	char *title;
 
 	PaneRendererCb *renderer;
+
+	uint64_t render_time;  // How long (in us) the last render took
 };
 
 /*
@@ -41,9 +46,82 @@ Pane *create_pane(uint32_t id, int h, int w, int y, int x, char *title, PaneRend
 void render_pane(Pane *pane);
 void delete_pane(Pane *pane);
 
+// Maximum length of the text in a line editor
+#define LINE_EDITOR_SIZE	256
+
+// Return values for LineEditor_handle_key
+#define LINE_EDITOR_CONTINUE	0  // The key was consumed; keep editing
+#define LINE_EDITOR_SUBMIT		1  // Enter was pressed
+#define LINE_EDITOR_CANCEL		2  // Escape was pressed
+#define LINE_EDITOR_EOF			3  // Ctrl-D was pressed on an empty line
+
+/*
+ * A single line of text entry, drawn on the bottom line of the screen.
+ *
+ * active		Whether the editor currently has keyboard focus
+ * prompt		The text displayed before the entered text
+ * buffer		The entered text. This is always null terminated.
+ * length		The length of the entered text
+ */
+typedef struct {
+	bool active;
+	const char *prompt;
+	char buffer[LINE_EDITOR_SIZE];
+	size_t length;
+} LineEditor;
+
+/*
+ * Gives a line editor keyboard focus and clears its text
+ *
+ * ed		The line editor to open
+ * prompt	The prompt to display
+ */
+void LineEditor_open(LineEditor *ed, const char *prompt);
+
+/*
+ * Passes a key press to a line editor.
+ *
+ * ed		The line editor
+ * ch		The key, as returned by getch
+ *
+ * Returns one of the LINE_EDITOR_* values. The editor stays active after a
+ * submit, so the caller decides whether to close it.
+ */
+int LineEditor_handle_key(LineEditor *ed, int ch);
+
+/*
+ * Draws a line editor on a line of a window.
+ *
+ * ed		The line editor to draw
+ * win		The window to draw to
+ * y		The line of the window to draw on
+ */
+void LineEditor_render(LineEditor *ed, WINDOW *win, int y);
+
 /* Specific pane renderers */
+/*
+ * Which part of the tape the Memory pane shows
+ *
+ * start		The index of the first cell shown
+ * cells		The number of cells which fit in the pane. Set by
+ * 				MemPaneRenderer.
+ * columns		The number of cells on each row. Set by MemPaneRenderer.
+ * query		The tape search whose answer the pane should jump to, or 0
+ */
+struct MemView {
+	size_t start;
+	size_t cells;
+	size_t columns;
+	unsigned query;
+};
+
+#ifndef _NOEXTERN
+extern struct MemView memview;
+#endif  // _NOEXTERN
+
 void MemPaneRenderer(Pane *pane);
 void OutPaneRenderer(Pane *pane);
+void StatsPaneRenderer(Pane *pane);
 
 #endif  // _UI_H_
 
@@ -0,0 +1,762 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "cache.h"
+
+/*
+ * The start of a cache file. Every section after it starts on an 8 byte
+ * boundary, and offsets are from the start of the file. Everything is in the
+ * host's byte order; cache files aren't meant to be moved between machines.
+ *
+ * magic			CACHE_MAGIC
+ * version			CACHE_VERSION
+ * op_size			sizeof(struct Op)
+ * key				What the program was built from
+ *
+ * program_length	The number of instructions
+ * index_size		The size of the instruction indices in the next three
+ * 					sections: 4 bytes, or 8 for programs too long for that
+ * pair_count		The number of matched pairs of brackets
+ * unmatched_count	The number of brackets without a partner
+ * break_count		The number of breakpoints
+ * break_next		Whether the next instruction loaded gets a breakpoint
+ * loop_count		The number of compiled loops
+ *
+ * program			The instructions, with comments already stripped
+ * pairs			The index of each matched [ followed by its ]'s
+ * unmatched		The indices of the brackets without a partner, in order
+ * breaks			The indices of the instructions with breakpoints
+ * loops			A struct CacheLoop for each compiled loop
+ */
+struct CacheHeader {
+	char magic[4];
+	uint32_t version;
+	uint64_t op_size;
+	CacheKey key;
+
+	uint64_t program_length;
+	uint64_t index_size;
+	uint64_t pair_count;
+	uint64_t unmatched_count;
+	uint64_t break_count;
+	uint64_t break_next;
+	uint64_t loop_count;
+
+	uint64_t program;
+	uint64_t pairs;
+	uint64_t unmatched;
+	uint64_t breaks;
+	uint64_t loops;
+};
+
+/*
+ * A compiled loop in a cache file
+ *
+ * open				The index of the loop's [
+ * length			The number of ops
+ * source_length	The number of instructions in the loop
+ * ops				The offset of the ops
+ */
+struct CacheLoop {
+	uint64_t open;
+	uint64_t length;
+	uint64_t source_length;
+	uint64_t ops;
+};
+
+/*
+ * The start of a prefix cache file, which holds the state interpreter_prefix
+ * left a program in. It is followed by the output, then the cells from
+ * tape_start on.
+ *
+ * magic			CACHE_PREFIX_MAGIC
+ * version			CACHE_VERSION
+ * key				What the program was built from
+ * budget			The budget interpreter_prefix was given
+ *
+ * program_length	The number of instructions in the program
+ * steps			The number of instructions executed
+ * ip				Where the program carries on from
+ * current_cell		The cell the pointer was left on
+ * status			Why the interpreter stopped
+ * output_bytes		The number of bytes output
+ * output_length	How many of the last of those are stored
+ * tape_start		The first cell stored. The rest of the tape is zero.
+ * tape_cells		The number of cells stored
+ */
+struct CachePrefix {
+	char magic[4];
+	uint32_t version;
+	CacheKey key;
+	uint64_t budget;
+
+	uint64_t program_length;
+	uint64_t steps;
+	uint64_t ip;
+	uint64_t current_cell;
+	uint64_t status;
+	uint64_t output_bytes;
+	uint64_t output_length;
+	uint64_t tape_start;
+	uint64_t tape_cells;
+};
+
+// Rounds a file offset up to the next section boundary
+#define CACHE_ALIGN(x) (((x) + 7) & ~(uint64_t)7)
+
+static inline uint64_t _rotl(uint64_t x, unsigned r) {
+	return (x << r) | (x >> (64 - r));
+}
+
+/*
+ * Helper function which scrambles the bits of a hash
+ */
+static inline uint64_t _Cache_mix(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDULL;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ULL;
+	h ^= h >> 33;
+
+	return h;
+}
+
+void Cache_key(CacheKey *key, size_t n, const char *src, const struct BrainfuckVM *vm) {
+	const uint64_t p1 = 0x9E3779B185EBCA87ULL, p2 = 0xC2B2AE3D27D4EB4FULL;
+	uint64_t a = 0x243F6A8885A308D3ULL, b = 0x13198A2E03707344ULL ^ n;
+	size_t i = 0;
+
+	// Two lanes, eight bytes at a time
+	for (; i + 16 <= n; i += 16) {
+		uint64_t x, y;
+		memcpy(&x, src + i, 8);
+		memcpy(&y, src + i + 8, 8);
+
+		a = _rotl(a + x * p2, 31) * p1;
+		b = _rotl(b + y * p2, 31) * p1;
+	}
+
+	for (; i < n; ++i) {
+		a = _rotl(a ^ ((uint8_t)src[i] * p2), 11) * p1;
+	}
+
+	key->hash[0] = _Cache_mix(a ^ _rotl(b, 17));
+	key->hash[1] = _Cache_mix(b + a * p2);
+	key->source_length = n;
+	key->cell_size = vm->cell_size;
+	key->tape_size = vm->tape_size;
+	key->flags = TIER_FLAGS;
+}
+
+/*
+ * Helper function which works out the path of a cache file, given what goes
+ * after the key in its name
+ */
+static char *_Cache_path(const CacheKey *key, const char *suffix) {
+	const char *base = getenv("XDG_CACHE_HOME");
+	const char *home = getenv("HOME");
+	char dir[4096];
+
+	if (base != NULL && *base != '\0') {
+		snprintf(dir, sizeof(dir), "%s", base);
+	} else if (home != NULL && *home != '\0') {
+		snprintf(dir, sizeof(dir), "%s/.cache", home);
+	} else {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	// The cache directory may not exist yet either
+	if (mkdir(dir, 0700) != 0 && errno != EEXIST) return NULL;
+
+	strncat(dir, "/bfdbg", sizeof(dir) - strlen(dir) - 1);
+
+	if (mkdir(dir, 0700) != 0 && errno != EEXIST) return NULL;
+
+	const size_t length = strlen(dir) + strlen(suffix) + 128;
+	char *path = malloc(length);
+
+	if (path == NULL) return NULL;
+
+	snprintf(path, length, "%s/%016" PRIx64 "%016" PRIx64 "-%" PRIu64 "-%" PRIu64 "-%" PRIx64 "%s",
+		dir, key->hash[0], key->hash[1], key->cell_size, key->tape_size, key->flags, suffix);
+
+	return path;
+}
+
+char *Cache_path(const CacheKey *key) {
+	return _Cache_path(key, ".bfc");
+}
+
+/*
+ * Helper function which checks that a section of n items of size bytes each
+ * lies inside a file of length bytes
+ */
+static bool _Cache_fits(uint64_t offset, uint64_t n, uint64_t size, uint64_t length) {
+	return offset % 8 == 0 && offset <= length && n <= (length - offset) / size;
+}
+
+/*
+ * Helper function which checks that a compiled loop can't make the op engine
+ * go wrong, in case the file is corrupt
+ */
+static bool _Cache_valid_loop(const struct BrainfuckVM *vm, const struct CacheLoop *loop, const struct Op *ops) {
+	if (loop->open >= vm->program_length || vm->program[loop->open] != '['
+	 || vm->_jumps[loop->open] == SIZE_MAX
+	 || vm->_jumps[loop->open] - loop->open + 1 != loop->source_length
+	 || loop->length == 0 || ops[loop->length - 1].type != OP_END) {
+		return false;
+	}
+
+	for (uint64_t i=0; i < loop->length; ++i) {
+		const struct Op *op = &ops[i];
+
+		if (op->type > OP_END || op->src > loop->source_length) return false;
+
+		switch (op->type) {
+			case OP_JZ:
+				// A loop is a matched [...], so everything in it is matched too
+				if (op->target >= loop->length) return false;
+				break;
+			case OP_JNZ:
+				if (op->target >= loop->length) return false;
+				break;
+			case OP_CLEAR:
+			case OP_MULADD:
+				if (op->target >= loop->length - i) return false;
+				break;
+		}
+	}
+
+	return true;
+}
+
+/*
+ * Helper function which reads the i'th number of a section of numbers size
+ * bytes wide
+ */
+static inline uint64_t _Cache_get(const uint8_t *section, uint64_t i, uint64_t size) {
+	if (size == 4) {
+		uint32_t v;
+		memcpy(&v, section + i * 4, 4);
+		return v;
+	}
+
+	uint64_t v;
+	memcpy(&v, section + i * 8, 8);
+	return v;
+}
+
+int Cache_load_prefix(struct BrainfuckVM *vm, const CacheKey *key, uint64_t budget) {
+	char *path = _Cache_path(key, ".bfp");
+	struct CachePrefix h;
+	uint8_t *data = NULL;
+	FILE *fp;
+
+	if (path == NULL) return -1;
+
+	fp = fopen(path, "rb");
+	free(path);
+
+	if (fp == NULL) return -1;
+
+	if (fread(&h, sizeof(struct CachePrefix), 1, fp) != 1
+	 || memcmp(h.magic, CACHE_PREFIX_MAGIC, 4) != 0
+	 || h.version != CACHE_VERSION
+	 || memcmp(&h.key, key, sizeof(CacheKey)) != 0
+	 || h.budget != budget
+	 || h.program_length != vm->program_length
+	 || h.steps > budget
+	 || h.ip > h.program_length
+	 || h.current_cell >= vm->tape_size
+	 || h.status > INTERPRETER_UNTIL
+	 || h.output_length > h.output_bytes
+	 || h.output_length > vm->output_tape_size
+	 || h.tape_start > vm->tape_size
+	 || h.tape_cells > vm->tape_size - h.tape_start) {
+		goto invalid;
+	}
+
+	const size_t tape_length = h.tape_cells * vm->cell_size;
+
+	// Read everything before touching the VM, so that a short file leaves it
+	// as it was
+	if ((data = malloc(h.output_length + tape_length + 1)) == NULL) {
+		fclose(fp);
+		return -1;
+	}
+
+	if (fread(data, 1, h.output_length + tape_length, fp) != h.output_length + tape_length) goto invalid;
+
+	fclose(fp);
+
+	for (size_t i=0; i < h.output_length; ++i) {
+		StringCassette_put(&vm->output, data[i]);
+	}
+
+	memcpy(vm->tape + h.tape_start * vm->cell_size, data + h.output_length, tape_length);
+
+	for (size_t i=0; i < h.tape_cells; ++i) {
+		Summary_touch(&vm->summary, h.tape_start + i);
+	}
+
+	free(data);
+
+	vm->steps = h.steps;
+	vm->output_bytes = h.output_bytes;
+	vm->ip = h.ip;
+	vm->current_cell = h.current_cell;
+	vm->status = h.status;
+
+	if (h.status == INTERPRETER_BREAK) {
+		// Stopped at a breakpoint, as interpreter_prefix would have
+		vm->stop_after = 0;
+		vm->_at_break = true;
+	}
+
+	return 0;
+
+invalid:
+	free(data);
+	fclose(fp);
+	errno = EINVAL;
+	return -1;
+}
+
+int Cache_save_prefix(const struct BrainfuckVM *vm, const CacheKey *key, uint64_t budget) {
+	const size_t tape_length = vm->tape_size * vm->cell_size;
+	struct CachePrefix h = {
+		.version = CACHE_VERSION,
+		.key = *key,
+		.budget = budget,
+		.program_length = vm->program_length,
+		.steps = vm->steps,
+		.ip = vm->ip,
+		.current_cell = vm->current_cell,
+		.status = vm->status,
+		.output_bytes = vm->output_bytes
+	};
+	char *path = _Cache_path(key, ".bfp");
+	char *tmp = NULL, *output = NULL;
+	FILE *fp = NULL;
+	size_t lo = 0, hi = tape_length;
+	int err;
+
+	memcpy(h.magic, CACHE_PREFIX_MAGIC, 4);
+
+	if (path == NULL) return -1;
+
+	// Only the cells between the first and last non-zero bytes are kept
+	while (lo < hi && vm->tape[lo] == 0) ++lo;
+	while (hi > lo && vm->tape[hi - 1] == 0) --hi;
+
+	h.tape_start = lo / vm->cell_size;
+	h.tape_cells = (lo < hi) ? (hi - 1) / vm->cell_size + 1 - h.tape_start : 0;
+
+	h.output_length = (h.output_bytes < vm->output.length) ? h.output_bytes : vm->output.length;
+
+	const size_t tmp_length = strlen(path) + 32;
+
+	if ((tmp = malloc(tmp_length)) == NULL || (output = malloc(h.output_length + 1)) == NULL) goto fail;
+
+	snprintf(tmp, tmp_length, "%s.%ld.tmp", path, (long)getpid());
+	StringCassette_tail(&vm->output, h.output_length, output);
+
+	if ((fp = fopen(tmp, "wb")) == NULL) goto fail;
+
+	fwrite(&h, sizeof(struct CachePrefix), 1, fp);
+	fwrite(output, 1, h.output_length, fp);
+	fwrite(vm->tape + h.tape_start * vm->cell_size, vm->cell_size, h.tape_cells, fp);
+
+	const bool failed = ferror(fp);
+
+	if ((fclose(fp) != 0) | failed) {
+		fp = NULL;
+		goto fail;
+	}
+
+	fp = NULL;
+
+	if (rename(tmp, path) != 0) goto fail;
+
+	free(output);
+	free(tmp);
+	free(path);
+	return 0;
+
+fail:
+	err = errno;
+
+	if (fp != NULL) fclose(fp);
+	if (tmp != NULL) unlink(tmp);
+
+	free(output);
+	free(tmp);
+	free(path);
+
+	errno = err;
+	return -1;
+}
+
+size_t Cache_compiled_loops(const struct BrainfuckVM *vm) {
+	size_t count = 0;
+
+	for (size_t i=0; i < vm->program_length; ++i) {
+		count += vm->_compiled[i] != NULL;
+	}
+
+	return count;
+}
+
+int Cache_load(struct BrainfuckVM *vm, const CacheKey *key) {
+	struct stat st;
+	char *path = Cache_path(key);
+	int fd;
+
+	if (path == NULL) return -1;
+
+	fd = open(path, O_RDONLY);
+	free(path);
+
+	if (fd == -1) return -1;
+
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	if ((uint64_t)st.st_size < sizeof(struct CacheHeader)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	const uint8_t *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) return -1;
+
+	const uint64_t length = st.st_size;
+	const struct CacheHeader *h = (const struct CacheHeader *)map;
+
+	if (memcmp(h->magic, CACHE_MAGIC, 4) != 0 || h->version != CACHE_VERSION
+	 || h->op_size != sizeof(struct Op) || memcmp(&h->key, key, sizeof(CacheKey)) != 0
+	 || vm->program_length != 0 || vm->_open_length != 0
+	 || !_Cache_fits(h->program, h->program_length, 1, length)
+	 || (h->index_size != 4 && h->index_size != 8)
+	 || !_Cache_fits(h->pairs, h->pair_count, 2 * h->index_size, length)
+	 || !_Cache_fits(h->unmatched, h->unmatched_count, h->index_size, length)
+	 || !_Cache_fits(h->breaks, h->break_count, h->index_size, length)
+	 || !_Cache_fits(h->loops, h->loop_count, sizeof(struct CacheLoop), length)) {
+		goto invalid;
+	}
+
+	const uint8_t *pairs = map + h->pairs;
+	const uint8_t *unmatched = map + h->unmatched;
+	const uint8_t *breaks = map + h->breaks;
+	const struct CacheLoop *loops = (const struct CacheLoop *)(map + h->loops);
+
+	// The new entries of the VM's other arrays are already zeroed, so only
+	// the instructions have to be copied and the brackets joined up
+	if (interpreter_reserve(vm, h->program_length) != 0) goto fail;
+
+	memcpy(vm->program, map + h->program, h->program_length);
+	vm->program_length = h->program_length;
+
+	// Every bracket has to be joined up exactly once below, so they start out
+	// unjoined, and are counted to check none were left out
+	uint64_t brackets = 0;
+
+	for (size_t i=0; i < vm->program_length; ++i) {
+		switch (vm->program[i]) {
+			case '[': case ']':
+				++brackets;
+				break;
+			case '+': case '-': case '>': case '<': case '.': case ',':
+				break;
+			default:
+				goto invalid_program;
+		}
+
+		vm->_jumps[i] = SIZE_MAX;
+	}
+
+	if (h->pair_count > brackets / 2 || brackets - 2 * h->pair_count != h->unmatched_count) goto invalid_program;
+
+	for (uint64_t i=0; i < h->pair_count; ++i) {
+		const uint64_t open = _Cache_get(pairs, 2*i, h->index_size);
+		const uint64_t close = _Cache_get(pairs, 2*i + 1, h->index_size);
+
+		if (open >= close || close >= vm->program_length
+		 || vm->program[open] != '[' || vm->program[close] != ']'
+		 || vm->_jumps[open] != SIZE_MAX || vm->_jumps[close] != SIZE_MAX) {
+			goto invalid_program;
+		}
+
+		vm->_jumps[open] = close;
+		vm->_jumps[close] = open;
+	}
+
+	// Unmatched [s are still waiting for their partners. Being in order means
+	// none is listed twice, so with the count above every bracket is covered.
+	for (uint64_t i=0; i < h->unmatched_count; ++i) {
+		const uint64_t bracket = _Cache_get(unmatched, i, h->index_size);
+
+		if (bracket >= vm->program_length || (i > 0 && bracket <= _Cache_get(unmatched, i - 1, h->index_size))
+		 || (vm->program[bracket] != '[' && vm->program[bracket] != ']')
+		 || vm->_jumps[bracket] != SIZE_MAX) {
+			goto invalid_program;
+		}
+
+		if (vm->program[bracket] == '[') {
+			if (vm->_open_length == vm->_open_capacity) {
+				size_t capacity = vm->_open_capacity ? vm->_open_capacity * 2 : 64;
+				size_t *grown = realloc(vm->_open, capacity * sizeof(size_t));
+
+				if (grown == NULL) goto fail_program;
+
+				vm->_open = grown;
+				vm->_open_capacity = capacity;
+			}
+
+			vm->_open[vm->_open_length++] = bracket;
+		}
+	}
+
+	for (uint64_t i=0; i < h->break_count; ++i) {
+		const uint64_t at = _Cache_get(breaks, i, h->index_size);
+
+		if (at >= vm->program_length || vm->_breaks[at]) goto invalid_program;
+		vm->_breaks[at] = true;
+	}
+
+	vm->_break_count = h->break_count;
+	vm->_break_next = h->break_next;
+
+	// Install the loops which were compiled last time
+	for (uint64_t i=0; i < h->loop_count; ++i) {
+		const struct CacheLoop *loop = &loops[i];
+
+		if (!_Cache_fits(loop->ops, loop->length, sizeof(struct Op), length)) continue;
+
+		const struct Op *ops = (const struct Op *)(map + loop->ops);
+		Program *p;
+
+		if (!_Cache_valid_loop(vm, loop, ops) || vm->_compiled[loop->open] != NULL) continue;
+		if ((p = malloc(sizeof(Program))) == NULL) break;
+
+		if ((p->ops = malloc(loop->length * sizeof(struct Op))) == NULL) {
+			free(p);
+			break;
+		}
+
+		memcpy(p->ops, ops, loop->length * sizeof(struct Op));
+		p->length = p->_capacity = loop->length;
+		p->source_length = loop->source_length;
+		p->tape_size = key->tape_size;
+		p->flags = key->flags;
+
+		vm->_compiled[loop->open] = p;
+	}
+
+	munmap((void *)map, length);
+
+	if (vm->trace != NULL) Trace_program(vm->trace, vm->program_length, vm->program);
+
+	return 0;
+
+fail_program:
+	// Leave the VM empty, with its arrays zeroed again
+	interpreter_unload(vm);
+	goto fail;
+invalid_program:
+	interpreter_unload(vm);
+invalid:
+	errno = EINVAL;
+fail:
+	munmap((void *)map, length);
+	return -1;
+}
+
+/*
+ * A buffered writer for cache files, as there can be millions of indices to
+ * write
+ *
+ * fp		The file being written
+ * offset	The number of bytes written so far
+ * length	The number of bytes in buf
+ */
+struct CacheWriter {
+	FILE *fp;
+	uint64_t offset;
+	size_t length;
+	uint8_t buf[65536];
+};
+
+/*
+ * Helper function which writes n bytes
+ */
+static void _Cache_write(struct CacheWriter *w, const void *data, size_t n) {
+	if (w->length + n > sizeof(w->buf)) {
+		fwrite(w->buf, 1, w->length, w->fp);
+		w->length = 0;
+	}
+
+	if (n > sizeof(w->buf)) {
+		fwrite(data, 1, n, w->fp);
+	} else {
+		memcpy(w->buf + w->length, data, n);
+		w->length += n;
+	}
+
+	w->offset += n;
+}
+
+/*
+ * Helper function which writes a number size bytes wide
+ */
+static inline void _Cache_put(struct CacheWriter *w, uint64_t v, size_t size) {
+	if (size == 4) {
+		const uint32_t narrow = v;
+		_Cache_write(w, &narrow, 4);
+	} else {
+		_Cache_write(w, &v, 8);
+	}
+}
+
+/*
+ * Helper function which writes zeros up to the next section boundary
+ */
+static void _Cache_pad(struct CacheWriter *w) {
+	static const uint8_t zeros[8] = { 0 };
+	_Cache_write(w, zeros, CACHE_ALIGN(w->offset) - w->offset);
+}
+
+int Cache_save(const struct BrainfuckVM *vm, const CacheKey *key) {
+	struct CacheHeader h = {
+		.version = CACHE_VERSION,
+		.op_size = sizeof(struct Op),
+		.key = *key,
+		.program_length = vm->program_length,
+		.index_size = (vm->program_length <= UINT32_MAX) ? 4 : 8,
+		.break_count = vm->_break_count,
+		.break_next = vm->_break_next
+	};
+	char *path = Cache_path(key);
+	char *tmp = NULL;
+	struct CacheWriter *w = NULL;
+	int err;
+
+	memcpy(h.magic, CACHE_MAGIC, 4);
+
+	if (path == NULL) return -1;
+
+	const size_t tmp_length = strlen(path) + 32;
+	if ((tmp = malloc(tmp_length)) == NULL || (w = calloc(1, sizeof(struct CacheWriter))) == NULL) goto fail;
+
+	snprintf(tmp, tmp_length, "%s.%ld.tmp", path, (long)getpid());
+
+	for (size_t i=0; i < vm->program_length; ++i) {
+		if (vm->program[i] != '[' && vm->program[i] != ']') continue;
+
+		if (vm->_jumps[i] == SIZE_MAX)
+			++h.unmatched_count;
+		else if (vm->program[i] == '[')
+			++h.pair_count;
+	}
+
+	h.loop_count = Cache_compiled_loops(vm);
+
+	// Lay the sections out one after another
+	h.program = CACHE_ALIGN(sizeof(struct CacheHeader));
+	h.pairs = CACHE_ALIGN(h.program + h.program_length);
+	h.unmatched = h.pairs + h.pair_count * 2 * h.index_size;
+	h.breaks = h.unmatched + h.unmatched_count * h.index_size;
+	h.loops = CACHE_ALIGN(h.breaks + h.break_count * h.index_size);
+
+	if ((w->fp = fopen(tmp, "wb")) == NULL) goto fail;
+
+	_Cache_write(w, &h, sizeof(struct CacheHeader));
+	_Cache_pad(w);
+	_Cache_write(w, vm->program, vm->program_length);
+	_Cache_pad(w);
+
+	for (size_t i=0; i < vm->program_length; ++i) {
+		if (vm->program[i] == '[' && vm->_jumps[i] != SIZE_MAX) {
+			_Cache_put(w, i, h.index_size);
+			_Cache_put(w, vm->_jumps[i], h.index_size);
+		}
+	}
+
+	for (size_t i=0; i < vm->program_length && h.unmatched_count > 0; ++i) {
+		if ((vm->program[i] == '[' || vm->program[i] == ']') && vm->_jumps[i] == SIZE_MAX) {
+			_Cache_put(w, i, h.index_size);
+		}
+	}
+
+	for (size_t i=0; i < vm->program_length && vm->_break_count > 0; ++i) {
+		if (vm->_breaks[i]) _Cache_put(w, i, h.index_size);
+	}
+
+	_Cache_pad(w);
+
+	// The table of loops, then their ops
+	uint64_t ops = h.loops + h.loop_count * sizeof(struct CacheLoop);
+
+	for (size_t i=0; i < vm->program_length && h.loop_count > 0; ++i) {
+		const Program *p = vm->_compiled[i];
+		if (p == NULL) continue;
+
+		const struct CacheLoop loop = {
+			.open = i,
+			.length = p->length,
+			.source_length = p->source_length,
+			.ops = ops
+		};
+
+		_Cache_write(w, &loop, sizeof(struct CacheLoop));
+		ops += p->length * sizeof(struct Op);
+	}
+
+	for (size_t i=0; i < vm->program_length && h.loop_count > 0; ++i) {
+		const Program *p = vm->_compiled[i];
+		if (p != NULL) _Cache_write(w, p->ops, p->length * sizeof(struct Op));
+	}
+
+	fwrite(w->buf, 1, w->length, w->fp);
+
+	const bool failed = ferror(w->fp);
+
+	if ((fclose(w->fp) != 0) | failed) {
+		w->fp = NULL;
+		goto fail;
+	}
+
+	if (rename(tmp, path) != 0) goto fail;
+
+	free(w);
+	free(tmp);
+	free(path);
+	return 0;
+
+fail:
+	err = errno;
+
+	if (w != NULL && w->fp != NULL) fclose(w->fp);
+	if (tmp != NULL) unlink(tmp);
+
+	free(w);
+	free(tmp);
+	free(path);
+
+	errno = err;
+	return -1;
+}
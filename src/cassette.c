@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include "cassette.h"
 
@@ -23,6 +24,13 @@ void StringCassette_write(StringCassette *c, const char *s) {
 	}
 }
 
+void StringCassette_put(StringCassette *c, char ch) {
+	// if the tail is past the end of the tape; wrap it back around
+	if (c->_tail >= c->length) c->_tail = 0;
+
+	c->_data[c->_tail++] = ch;
+}
+
 size_t StringCassette_read(StringCassette *c, size_t n, char *buf, size_t offset) {
 	// ensure offset is within array bounds
 	size_t index = (offset) % c->length;
@@ -42,3 +50,17 @@ size_t StringCassette_read(StringCassette *c, size_t n, char *buf, size_t offset
 	return index;
 }
 
+
+size_t StringCassette_tail(const StringCassette *c, size_t n, char *buf) {
+	if (n > c->length) n = c->length;
+
+	// _tail is one past the newest byte, so the oldest wanted byte is n before
+	// it; copy up to the end of the tape, then whatever wrapped round
+	const size_t start = (c->_tail >= n) ? c->_tail - n : c->_tail + c->length - n;
+	const size_t first = (c->length - start < n) ? c->length - start : n;
+
+	memcpy(buf, c->_data + start, first);
+	memcpy(buf + first, c->_data, n - first);
+
+	return n;
+}
@@ -0,0 +1,233 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "codegen.h"
+
+extern char **environ;
+
+/*
+ * Helper function which reduces a signed distance to the equivalent forward
+ * distance on a tape of the given size
+ */
+static uint64_t _codegen_wrap(int64_t d, size_t tape_size) {
+	if (d >= 0) return (uint64_t)d % tape_size;
+
+	return (tape_size - ((uint64_t)0 - (uint64_t)d) % tape_size) % tape_size;
+}
+
+/*
+ * Helper function which indents a line of generated code
+ */
+static void _codegen_indent(FILE *fp, size_t depth) {
+	for (size_t i=0; i <= depth; ++i) putc('\t', fp);
+}
+
+int codegen_c(const Program *p, FILE *fp, const struct CodegenOptions *opt) {
+	const uint64_t cell_mask = (opt->cell_size >= 8) ? UINT64_MAX : (UINT64_C(1) << (opt->cell_size * 8)) - 1;
+	const int cell_bits = (opt->cell_size <= 1) ? 8
+		: (opt->cell_size <= 2) ? 16
+		: (opt->cell_size <= 4) ? 32 : 64;
+
+	size_t depth = 0;
+	bool uses_end = false;
+
+	fprintf(fp, "/* Generated by bfdbg from a %zu instruction program */\n", p->source_length);
+	fprintf(fp, "#include <stdint.h>\n#include <stdio.h>\n\n");
+	fprintf(fp, "#define TAPE_SIZE ((size_t)%zu)\n", opt->tape_size);
+	fprintf(fp, "#define CELL_MASK UINT64_C(0x%" PRIx64 ")\n\n", cell_mask);
+	fprintf(fp, "typedef uint%d_t cell_t;\n\n", cell_bits);
+	fprintf(fp, "// Moves the pointer d cells forwards, where d < TAPE_SIZE\n");
+	fprintf(fp, "#define MOVE(d) do { p += (d); if (p >= TAPE_SIZE) p -= TAPE_SIZE; } while (0)\n");
+	fprintf(fp, "// The index of the cell d cells ahead of the pointer, where d < TAPE_SIZE\n");
+	fprintf(fp, "#define AT(d) ((p + (d) >= TAPE_SIZE) ? p + (d) - TAPE_SIZE : p + (d))\n");
+	fprintf(fp, "// Adds to a cell, wrapping at the cell size\n");
+	fprintf(fp, "#define ADD(x, v) ((x) = (cell_t)(((uint64_t)(x) + (v)) & CELL_MASK))\n\n");
+	fprintf(fp, "static cell_t tape[TAPE_SIZE];\n\n");
+
+	if (opt->dump_state) {
+		fprintf(fp, "// Writes the pointer and the tape to stderr\n");
+		fprintf(fp, "static void dump_state(size_t p) {\n");
+		fprintf(fp, "\tstatic uint64_t state[TAPE_SIZE + 1];\n\n");
+		fprintf(fp, "\tstate[0] = p;\n");
+		fprintf(fp, "\tfor (size_t i=0; i < TAPE_SIZE; ++i) state[i + 1] = tape[i];\n\n");
+		fprintf(fp, "\tfwrite(state, sizeof(uint64_t), TAPE_SIZE + 1, stderr);\n");
+		fprintf(fp, "}\n\n");
+	}
+	fprintf(fp, "int main(void) {\n\tsize_t p = 0;\n\tint c;\n\n\t(void)c;\n\n");
+
+	for (size_t i=0; i < p->length; ++i) {
+		const struct Op *op = &p->ops[i];
+
+		if (op->type == OP_JNZ) --depth;
+		if (op->type != OP_END && op->type != OP_NOP && op->type != OP_TERM) _codegen_indent(fp, depth);
+
+		switch (op->type) {
+			case OP_ADD:
+				fprintf(fp, "ADD(tape[p], UINT64_C(%" PRIu64 "));\n", (uint64_t)op->arg);
+				break;
+			case OP_MOVE:
+				fprintf(fp, "MOVE(%" PRIu64 ");\n", _codegen_wrap(op->arg, opt->tape_size));
+				break;
+			case OP_OUT:
+				fprintf(fp, "putchar((unsigned char)tape[p]);\n");
+				break;
+			case OP_IN:
+				fprintf(fp, "fflush(stdout);\n");
+				_codegen_indent(fp, depth);
+
+				switch (opt->eof_behaviour) {
+					case EOF_UNCHANGED:
+						fprintf(fp, "if ((c = getchar()) != EOF) tape[p] = c;\n");
+						break;
+					case EOF_ZERO:
+						fprintf(fp, "tape[p] = ((c = getchar()) != EOF) ? c : 0;\n");
+						break;
+					case EOF_NEGATIVE:
+						fprintf(fp, "tape[p] = ((c = getchar()) != EOF) ? (cell_t)c : (cell_t)CELL_MASK;\n");
+						break;
+				}
+				break;
+			case OP_JZ:
+				if (op->target == OP_UNMATCHED) {
+					// the interpreter would wait forever for the ]
+					fprintf(fp, "if (!tape[p]) goto end;\n");
+					uses_end = true;
+				} else {
+					fprintf(fp, "while (tape[p]) {\n");
+					++depth;
+				}
+				break;
+			case OP_JNZ:
+				fprintf(fp, "}\n");
+				break;
+			case OP_NOP:
+				break;
+			case OP_CLEAR:
+				fprintf(fp, "tape[p] = 0;\n");
+				break;
+			case OP_SCAN:
+				fprintf(fp, "while (tape[p]) MOVE(%" PRIu64 ");\n", _codegen_wrap(op->arg, opt->tape_size));
+				break;
+			case OP_MULADD:
+				fprintf(fp, "if (tape[p]) {\n");
+				_codegen_indent(fp, depth+1);
+
+				// the number of iterations the loop would have made
+				if (op->arg == -1)
+					fprintf(fp, "const uint64_t n = tape[p];\n");
+				else
+					fprintf(fp, "const uint64_t n = (0 - (uint64_t)tape[p]) & CELL_MASK;\n");
+
+				for (uint32_t t=1; t <= op->target; ++t) {
+					_codegen_indent(fp, depth+1);
+					fprintf(fp, "ADD(tape[AT(%" PRIu64 ")], n * UINT64_C(%" PRIu64 "));\n",
+							_codegen_wrap(op[t].offset, opt->tape_size), (uint64_t)op[t].arg);
+				}
+
+				_codegen_indent(fp, depth+1);
+				fprintf(fp, "tape[p] = 0;\n");
+				_codegen_indent(fp, depth);
+				fprintf(fp, "}\n");
+				break;
+			case OP_TERM:
+				// written out with their OP_MULADD
+				break;
+			case OP_END:
+				break;
+		}
+	}
+
+	if (uses_end) fprintf(fp, "\nend:\n");
+	fprintf(fp, "\tfflush(stdout);\n");
+	if (opt->dump_state) fprintf(fp, "\tdump_state(p);\n");
+	fprintf(fp, "\treturn 0;\n}\n");
+
+	return ferror(fp) ? -1 : 0;
+}
+
+// Most words $CC can be split into
+#define CODEGEN_MAX_CC_WORDS	32
+
+int codegen_executable(const Program *p, const char *path, const struct CodegenOptions *opt) {
+	const char *tmpdir = getenv("TMPDIR");
+	const char *cc = getenv("CC");
+	char source[4096];
+	int fd, status;
+	pid_t pid;
+	FILE *fp;
+
+	if (tmpdir == NULL || *tmpdir == '\0') tmpdir = "/tmp";
+	if (cc == NULL || *cc == '\0') cc = "cc";
+
+	// Write the C source to a temporary file
+	if ((size_t)snprintf(source, sizeof(source), "%s/bfdbg-XXXXXX.c", tmpdir) >= sizeof(source)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	if ((fd = mkstemps(source, 2)) == -1) return -1;
+
+	if ((fp = fdopen(fd, "w")) == NULL) {
+		close(fd);
+		unlink(source);
+		return -1;
+	}
+
+	if (codegen_c(p, fp, opt) != 0) {
+		fclose(fp);
+		unlink(source);
+		return -1;
+	}
+
+	fclose(fp);
+
+	// Then hand it to the compiler. $CC can carry arguments of its own, like
+	// make allows, so it's split into words on whitespace.
+	char *argv[CODEGEN_MAX_CC_WORDS + 5];
+	char *words = strdup(cc), *save = NULL;
+	size_t argc = 0;
+	int err;
+
+	if (words == NULL) {
+		unlink(source);
+		return -1;
+	}
+
+	for (char *word = strtok_r(words, " \t\n", &save); word != NULL; word = strtok_r(NULL, " \t\n", &save)) {
+		if (argc == CODEGEN_MAX_CC_WORDS) break;
+		argv[argc++] = word;
+	}
+
+	argv[argc++] = "-O2";
+	argv[argc++] = "-o";
+	argv[argc++] = (char *)path;
+	argv[argc++] = source;
+	argv[argc] = NULL;
+
+	// $CC was nothing but whitespace
+	err = (argc == 4) ? ENOENT : posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ);
+	free(words);
+
+	if (err != 0) {
+		unlink(source);
+		errno = err;
+		return -1;
+	}
+
+	while (waitpid(pid, &status, 0) == -1 && errno == EINTR);
+
+	unlink(source);
+
+	// The compiler ran, so errno is left clear even if it failed
+	errno = 0;
+	return (WIFEXITED(status) && WEXITSTATUS(status) == 0) ? 0 : -1;
+}
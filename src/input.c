@@ -0,0 +1,204 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <threads.h>
+
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "input.h"
+
+int InputSource_open(InputSource *in, const char *path) {
+	struct stat st;
+
+	memset(in, 0, sizeof(InputSource));
+
+	if (strcmp(path, "-") == 0) {
+		in->_fd = STDIN_FILENO;
+	} else if ((in->_fd = open(path, O_RDONLY)) == -1) {
+		return -1;
+	}
+
+	// Regular files can be mapped in their entirety; the whole file is then
+	// the buffer and no refills are ever needed
+	if (fstat(in->_fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->_fd, 0);
+
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+			in->type = INPUT_FILE;
+			in->_data = map;
+			in->_length = st.st_size;
+			in->_eof = true;
+			return 0;
+		}
+	}
+
+	// Anything else gets read in large blocks
+	in->type = INPUT_PIPE;
+	in->_data = malloc(INPUT_BUFFER_SIZE);
+
+	if (in->_data == NULL) {
+		if (in->_fd != STDIN_FILENO) close(in->_fd);
+		return -1;
+	}
+
+	return 0;
+}
+
+void InputSource_init_interactive(InputSource *in) {
+	memset(in, 0, sizeof(InputSource));
+
+	in->type = INPUT_INTERACTIVE;
+	in->_fd = -1;
+	mtx_init(&in->_lock, mtx_plain);
+}
+
+void InputSource_free(InputSource *in) {
+	switch (in->type) {
+		case INPUT_FILE:
+			if (in->_data != NULL) munmap(in->_data, in->_length);
+			if (in->_fd != STDIN_FILENO) close(in->_fd);
+			break;
+		case INPUT_PIPE:
+			free(in->_data);
+			if (in->_fd != STDIN_FILENO) close(in->_fd);
+			break;
+		case INPUT_INTERACTIVE:
+			free(in->_data);
+			free(in->_pending);
+			mtx_destroy(&in->_lock);
+			break;
+	}
+
+	in->_data = NULL;
+	in->_length = in->_pos = 0;
+}
+
+void InputSource_rewind(InputSource *in) {
+	switch (in->type) {
+		case INPUT_FILE:
+			in->_pos = 0;
+			break;
+		case INPUT_PIPE:
+			// data that has been read from a pipe is gone
+			break;
+		case INPUT_INTERACTIVE:
+			mtx_lock(&in->_lock);
+			in->_pos = in->_length = 0;
+			in->_pending_length = 0;
+			in->_eof = in->_pending_eof = false;
+			mtx_unlock(&in->_lock);
+			break;
+	}
+}
+
+int InputSource_push(InputSource *in, size_t n, const char *data) {
+	if (in->type != INPUT_INTERACTIVE) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (mtx_lock(&in->_lock) != thrd_success) {
+		errno = ENOLCK;
+		return -1;
+	}
+
+	uint8_t *pending = realloc(in->_pending, in->_pending_length + n);
+
+	if (pending == NULL) {
+		mtx_unlock(&in->_lock);
+		return -1;
+	}
+
+	memcpy(pending + in->_pending_length, data, n);
+	in->_pending = pending;
+	in->_pending_length += n;
+
+	mtx_unlock(&in->_lock);
+
+	return 0;
+}
+
+void InputSource_close(InputSource *in) {
+	if (in->type != INPUT_INTERACTIVE) return;
+
+	mtx_lock(&in->_lock);
+	in->_pending_eof = true;
+	mtx_unlock(&in->_lock);
+}
+
+int _InputSource_refill(InputSource *in) {
+	if (in->type == INPUT_PIPE) {
+		if (in->_eof) return INPUT_EOF;
+
+		ssize_t n;
+
+		// Only read once there's something to read, so that a slow or idle
+		// writer can't block the interpreter thread, and with it quitting or
+		// resetting the VM
+		struct pollfd pfd = { .fd = in->_fd, .events = POLLIN };
+		const int ready = poll(&pfd, 1, 0);
+
+		if (ready == 0 || (ready < 0 && errno == EINTR)) return INPUT_AGAIN;
+
+		// Fill as much of the buffer as a single read will give us
+		do {
+			n = read(in->_fd, in->_data, INPUT_BUFFER_SIZE);
+		} while (n == -1 && errno == EINTR);
+
+		in->_length = in->_pos = 0;
+
+		if (n == 0) {
+			in->_eof = true;
+			return INPUT_EOF;
+		}
+
+		if (n < 0) {
+			// The , is left waiting rather than the input being cut short
+			if (errno != EAGAIN && errno != EWOULDBLOCK) in->error = errno;
+			return INPUT_AGAIN;
+		}
+
+		in->_length = n;
+		in->error = 0;
+	} else if (in->type == INPUT_INTERACTIVE) {
+		if (in->_eof) return INPUT_EOF;
+
+		// Swap in whatever the UI has submitted since the last refill. The
+		// lock is only taken once per submitted line, not once per byte.
+		if (mtx_lock(&in->_lock) != thrd_success) return INPUT_AGAIN;
+
+		if (in->_pending_length == 0) {
+			in->_eof = in->_pending_eof;
+			in->_starved = !in->_eof;
+			mtx_unlock(&in->_lock);
+
+			return in->_eof ? INPUT_EOF : INPUT_AGAIN;
+		}
+
+		uint8_t *drained = in->_data;
+
+		in->_data = in->_pending;
+		in->_length = in->_pending_length;
+		in->_pos = 0;
+
+		in->_pending = NULL;
+		in->_pending_length = 0;
+		in->_starved = false;
+
+		mtx_unlock(&in->_lock);
+
+		// The previous line has been fully read
+		free(drained);
+	} else {
+		// Mapped files are read in full the first time round
+		return INPUT_EOF;
+	}
+
+	return in->_data[in->_pos++];
+}
@@ -1,75 +1,1031 @@
+#include <errno.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <threads.h>
+#include <time.h>
 
 #include "interpreter.h"
+#include "tape.h"
+
+// How long to wait (in ns) before polling an interactive input source again
+#define INPUT_POLL_DELAY	1000000
+
+// Maximum number of instructions executed between checks of the VM's controls
+#define RUN_BATCH	4096
+
+// Maximum number of instructions moved out of the queue at once
+#define FETCH_BATCH	256
+
+// Longest loop body which is checked for being a scan loop
+#define SCAN_MAX_BODY	16
+
+// Minimum time (in ns) between snapshots published for the UI
+#define SNAPSHOT_INTERVAL	10000000
+
+// Most summary blocks re-counted for each snapshot
+#define SUMMARY_REFRESH_BLOCKS	64
+
+// Compiled loops are only entered with at least this many steps to run, so
+// that single-stepping stays in the interpreter
+#define TIER_MIN_BUDGET	64
+
+// Maximum number of instructions executed between checks of the VM's
+// controls while it runs until something happens
+#define UNTIL_BATCH	(1 << 20)
+
+/*
+ * What interpreter_run is watching for; a copy of the VM's until fields
+ * taken when it starts.
+ */
+struct Watch {
+	int until;
+	size_t cell;
+	uintmax_t value;
+};
+
+/*
+ * Helper function which returns the monotonic time in ns
+ */
+static uint64_t _now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * Helper function which grows an array from old to capacity entries of size
+ * bytes each, zeroing the new ones. The first allocation is calloc'd, which
+ * is free for big programs.
+ */
+static void *_grow_zeroed(void *p, size_t old, size_t capacity, size_t size) {
+	if (p == NULL) return calloc(capacity, size);
+
+	char *grown = realloc(p, capacity * size);
+	if (grown != NULL) memset(grown + old * size, 0, (capacity - old) * size);
+
+	return grown;
+}
+
+int interpreter_reserve(struct BrainfuckVM *vm, size_t n) {
+	if (vm->program_length + n <= vm->_program_capacity) return 0;
+
+	const size_t old = vm->_program_capacity;
+
+	size_t capacity = vm->_program_capacity ? vm->_program_capacity : 1024;
+	while (capacity < vm->program_length + n) capacity *= 2;
+
+	char *program = realloc(vm->program, capacity);
+	if (program == NULL) return -1;
+	vm->program = program;
+
+	size_t *jumps = realloc(vm->_jumps, capacity * sizeof(size_t));
+	if (jumps == NULL) return -1;
+	vm->_jumps = jumps;
+
+	bool *breaks = _grow_zeroed(vm->_breaks, old, capacity, sizeof(bool));
+	if (breaks == NULL) return -1;
+	vm->_breaks = breaks;
+
+	uint32_t *heat = _grow_zeroed(vm->_heat, old, capacity, sizeof(uint32_t));
+	if (heat == NULL) return -1;
+	vm->_heat = heat;
+
+	Program **compiled = _grow_zeroed(vm->_compiled, old, capacity, sizeof(Program *));
+	if (compiled == NULL) return -1;
+	vm->_compiled = compiled;
+
+	vm->_program_capacity = capacity;
+	return 0;
+}
+
+int interpreter_load(struct BrainfuckVM *vm, size_t n, const char *src) {
+	const size_t start = vm->program_length;
+
+	if (interpreter_reserve(vm, n) != 0) return -1;
+
+	for (size_t i=0; i < n; ++i) {
+		const size_t here = vm->program_length;
+
+		switch (src[i]) {
+			case '[':
+				// Remember this bracket until its partner arrives
+				if (vm->_open_length == vm->_open_capacity) {
+					size_t capacity = vm->_open_capacity ? vm->_open_capacity * 2 : 64;
+					size_t *open = realloc(vm->_open, capacity * sizeof(size_t));
+
+					if (open == NULL) return -1;
+
+					vm->_open = open;
+					vm->_open_capacity = capacity;
+				}
+
+				vm->_open[vm->_open_length++] = here;
+				vm->_jumps[here] = SIZE_MAX;
+				break;
+			case ']':
+				if (vm->_open_length > 0) {
+					size_t partner = vm->_open[--vm->_open_length];
+
+					vm->_jumps[here] = partner;
+					vm->_jumps[partner] = here;
+				} else {
+					// unmatched; this bracket does nothing
+					vm->_jumps[here] = SIZE_MAX;
+				}
+				break;
+			case '+':
+			case '-':
+			case '>':
+			case '<':
+			case '.':
+			case ',':
+				break;
+			case '#':
+				// a breakpoint on whichever instruction comes next
+				vm->_break_next = true;
+				continue;
+			default:
+				// not an instruction
+				continue;
+		}
+
+		if (vm->_break_next) {
+			vm->_breaks[here] = true;
+			++vm->_break_count;
+			vm->_break_next = false;
+		}
+
+		vm->program[vm->program_length++] = src[i];
+	}
+
+	if (vm->trace != NULL && vm->program_length > start) {
+		Trace_program(vm->trace, vm->program_length - start, vm->program + start);
+	}
+
+	return 0;
+}
+
+void interpreter_unload(struct BrainfuckVM *vm) {
+	// Nothing can be compiled for this program any more
+	Tier_stop(&vm->_tier);
+
+	if (vm->trace != NULL) Trace_unload(vm->trace);
+
+	for (size_t i=0; i < vm->program_length; ++i) {
+		if (vm->_compiled[i] == NULL) continue;
+
+		Program_free(vm->_compiled[i]);
+		free(vm->_compiled[i]);
+	}
+
+	free(vm->program);
+	free(vm->_jumps);
+	free(vm->_open);
+	free(vm->_breaks);
+	free(vm->_heat);
+	free(vm->_compiled);
+
+	vm->program = NULL;
+	vm->_jumps = vm->_open = NULL;
+	vm->_breaks = NULL;
+	vm->_heat = NULL;
+	vm->_compiled = NULL;
+	vm->program_length = vm->_program_capacity = 0;
+	vm->_open_length = vm->_open_capacity = 0;
+	vm->_break_count = 0;
+	vm->_break_next = vm->_at_break = false;
+	vm->ip = 0;
+}
+
+/*
+ * Helper function which moves instructions out of the instruction queue and
+ * into the program. Returns the number of characters taken from the queue.
+ */
+static size_t _fetch(struct BrainfuckVM *vm) {
+	char buf[FETCH_BATCH];
+	size_t n = 0;
+
+	while (n < FETCH_BATCH && vm->instructionQueue.length > 0) {
+		buf[n++] = Queue_dequeue(&vm->instructionQueue);
+	}
+
+	if (n > 0) interpreter_load(vm, n, buf);
+
+	return n;
+}
+
+/*
+ * Helper function which moves a cell index by an offset, wrapping around the
+ * tape.
+ */
+static inline size_t _move(size_t cell, int64_t by, size_t tape_size) {
+	int64_t off = by % (int64_t)tape_size;
+	if (off < 0) off += tape_size;
+
+	cell += off;
+	return (cell >= tape_size) ? cell - tape_size : cell;
+}
+
+/*
+ * Helper function which checks whether a pointer which wanders over cells
+ * [cell+lo, cell+hi] one move at a time could land on cell target. lo <= 0 <=
+ * hi. This errs on the side of yes.
+ */
+static bool _lands_on(size_t cell, int64_t lo, int64_t hi, size_t target, size_t tape_size) {
+	if (lo == 0 && hi == 0) return false;
+	if ((uint64_t)(hi - lo) >= tape_size - 1) return true;
+
+	const size_t off = (target >= cell) ? target - cell : target + tape_size - cell;
+	return (int64_t)off <= hi || (int64_t)off - (int64_t)tape_size >= lo;
+}
+
+/*
+ * Helper function which returns how many whole iterations of a scan loop
+ * can run before the pointer lands on the watched cell. Returns UINT64_MAX if
+ * the pointer isn't being watched, so there's no limit. Returns 0 if the loop
+ * can't be fast-forwarded at all and has to be run an instruction at a time:
+ * when the next iteration reaches the cell, or when the body doesn't move
+ * one way only, which is too hard to predict.
+ */
+static uint64_t _scan_limit(const struct Watch *w, size_t cell, int64_t stride, size_t body, size_t tape_size) {
+	if (w->until != UNTIL_POINTER) return UINT64_MAX;
+
+	const uint64_t step = (stride < 0) ? -(uint64_t)stride : (uint64_t)stride;
+	if (step != body) return 0;
+
+	// Moves until the pointer lands on the cell, going the loop's way
+	const size_t from = (stride > 0) ? cell : w->cell;
+	const size_t to = (stride > 0) ? w->cell : cell;
+	size_t d = (to >= from) ? to - from : to + (tape_size - from);
+	if (d == 0) d = tape_size;
+
+	return (d - 1) / step;
+}
+
+void interpreter_reset(struct BrainfuckVM *vm) {
+	// Finish off the trace's last block before the state is lost
+	if (vm->trace != NULL) {
+		Trace_block(vm->trace, vm->steps, vm->ip,
+			(vm->ip < vm->program_length) ? vm->program[vm->ip] : 0,
+			vm->current_cell, vm_get_cell(vm, vm->current_cell));
+	}
+
+	Queue_free(&vm->instructionQueue);
+	StringCassette_free(&vm->output);
+
+	vm->current_cell = 0;
+	vm->die = false;
+	vm->steps = 0;
+	vm->output_bytes = 0;
+	vm->idle_time = 0;
+
+	// the program is kept and run again from the start
+	vm->ip = 0;
+	vm->status = INTERPRETER_OK;
+	vm->_at_break = false;
+
+	if (vm->trace != NULL) Trace_reset(vm->trace);
+
+	StringCassette_init(&vm->output, vm->output_tape_size);
+	Queue_init(&vm->instructionQueue);
+	InputSource_rewind(&vm->input);
+
+	// the tape is reused rather than reallocated
+	tape_clear(vm->tape, vm->tape_size * vm->cell_size);
+	Summary_clear(&vm->summary);
+}
+
+int interpreter_set_break(struct BrainfuckVM *vm, size_t i, bool on) {
+	if (i >= vm->program_length) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if (vm->_breaks[i] == on) return 0;
+
+	vm->_breaks[i] = on;
+
+	if (!on) {
+		--vm->_break_count;
+		return 0;
+	}
+
+	++vm->_break_count;
+
+	// Compiled loops would run straight past it, so any around it go back to
+	// being interpreted. They have to warm up again to be recompiled once the
+	// breakpoint is cleared.
+	for (size_t open=0; open < i; ++open) {
+		Program *p = vm->_compiled[open];
+
+		if (p != NULL && vm->_jumps[open] > i) {
+			Program_free(p);
+			free(p);
+			vm->_compiled[open] = NULL;
+			vm->_heat[open] = 0;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Helper function which runs a loop that only moves the pointer, e.g. [>] or
+ * [<<<], with a vectorised search rather than one instruction at a time. It
+ * is called on the loop's [ or ] while the current cell is non-zero, and runs
+ * as many iterations as fit in budget steps.
+ *
+ * open is the index of the loop's [. ip and cell are updated to where the
+ * loop left off. Returns the number of steps taken, or 0 if the loop isn't a
+ * scan loop or can't be run this way without missing what w is watching for.
+ */
+static size_t _scan(struct BrainfuckVM *vm, size_t open, size_t *ip, size_t *cell, size_t budget,
+					const struct Watch *w) {
+	const size_t close = vm->_jumps[open];
+
+	if (close == SIZE_MAX || close - open - 1 > SCAN_MAX_BODY || vm->_breaks[close]) return 0;
+
+	const size_t body = close - open - 1;
+	ssize_t stride = 0;
+
+	for (size_t i=open+1; i < close; ++i) {
+		if (vm->_breaks[i])
+			return 0;
+		else if (vm->program[i] == '>')
+			++stride;
+		else if (vm->program[i] == '<')
+			--stride;
+		else
+			return 0;
+	}
+
+	// Each iteration is the body and the ], on top of the [ or ] we're on.
+	// Loops which end up back on the same cell never stop.
+	if (body == 0 || budget < body + 2 || stride % (ssize_t)vm->tape_size == 0) return 0;
+
+	uint64_t iterations = (budget - 1) / (body + 1);
+	const uint64_t limit = _scan_limit(w, *cell, stride, body, vm->tape_size);
+
+	if (limit == 0) return 0;
+	if (iterations > limit) iterations = limit;
+
+	if (tape_scan(vm->tape, vm->tape_size, vm->cell_size, cell, stride, &iterations)) {
+		*ip = close + 1;
+	} else {
+		// Out of budget part way through; carry on from the top of the body
+		*ip = open + 1;
+	}
+
+	return 1 + iterations * (body + 1);
+}
+
+/*
+ * Helper function which queues a hot loop to be compiled. open is the index
+ * of the loop's [. Loops containing breakpoints are left to the interpreter,
+ * so that the breakpoints still fire, and start warming up again in case the
+ * breakpoints are cleared.
+ */
+static void _promote(struct BrainfuckVM *vm, size_t open) {
+	const size_t close = vm->_jumps[open];
+
+	if (vm->_break_count > 0) {
+		for (size_t i=open; i <= close; ++i) {
+			if (vm->_breaks[i]) {
+				vm->_heat[open] = 0;
+				return;
+			}
+		}
+	}
+
+	// If this fails the loop just stays interpreted
+	Tier_request(&vm->_tier, open, close - open + 1, vm->program + open, vm->tape_size);
+}
+
+/*
+ * Helper function which installs the loops the tier has finished compiling
+ */
+static void _install(struct BrainfuckVM *vm) {
+	TierJob *job = Tier_collect(&vm->_tier);
+
+	while (job != NULL) {
+		TierJob *next = job->_next;
+		Program *p = NULL;
+
+		// A breakpoint may have been set in the loop since it was queued
+		bool broken = false;
+
+		for (size_t i=job->open; vm->_break_count > 0 && i <= vm->_jumps[job->open] && !broken; ++i) {
+			broken = vm->_breaks[i];
+		}
+
+		if (job->result == 0 && !broken && vm->_compiled[job->open] == NULL
+		 && (p = malloc(sizeof(Program))) != NULL) {
+			*p = job->program;
+			vm->_compiled[job->open] = p;
+		} else if (job->result == 0) {
+			Program_free(&job->program);
+		}
+
+		if (broken) vm->_heat[job->open] = 0;
+
+		Tier_free_job(job);
+		job = next;
+	}
+}
+
+/*
+ * Helper function which checks whether running an OP_CLEAR or OP_MULADD in one
+ * go could skip past what w is watching for. c is the current cell.
+ */
+static bool _watched(const struct BrainfuckVM *vm, size_t open, const struct Op *op, size_t c,
+					 const struct Watch *w) {
+	const size_t tape_size = vm->tape_size;
+
+	if (w->until == UNTIL_VALUE) {
+		// Every cell the loop writes goes through values on the way
+		if (c == w->cell) return true;
+
+		for (uint32_t j=1; j <= op->target; ++j) {
+			if (_move(c, op[j].offset, tape_size) == w->cell) return true;
+		}
+	} else if (w->until == UNTIL_POINTER) {
+		// The pointer lands on every cell between the furthest two the body
+		// goes to, which might be further out than the ones it writes
+		const size_t close = vm->_jumps[open + op->src];
+		int64_t at = 0, lo = 0, hi = 0;
+
+		for (size_t i=open + op->src + 1; i < close; ++i) {
+			if (vm->program[i] == '>' && ++at > hi) hi = at;
+			if (vm->program[i] == '<' && --at < lo) lo = at;
+		}
+
+		return _lands_on(c, lo, hi, w->cell, tape_size);
+	}
+
+	return false;
+}
+
+/*
+ * Helper function which runs a compiled loop. It is entered on the loop's [
+ * or on its ] while the current cell is non-zero, since either way the
+ * instruction takes one step and then the body runs.
+ *
+ * An op only runs if all of its steps fit in budget. Otherwise the
+ * interpreter takes over at the op's first instruction, so the VM stops in
+ * exactly the same state it would have if the loop had been interpreted.
+ * Input is always left to the interpreter, as is anything that might be
+ * what w is watching for.
+ *
+ * open is the index of the loop's [. ip and cell are updated to where the
+ * loop left off. Returns the number of steps taken, or 0 if the loop's first
+ * op couldn't run, in which case ip and cell are left alone.
+ */
+static size_t _run_compiled(struct BrainfuckVM *vm, size_t open, size_t *ip, size_t *cell,
+							size_t budget, uint64_t *output_bytes, const struct Watch *w) {
+	const Program *p = vm->_compiled[open];
+	const uintmax_t cell_mask = VM_CELL_MASK(vm);
+	const size_t tape_size = vm->tape_size;
+
+	size_t c = *cell;
+	uintmax_t value = vm_get_cell(vm, c);
+	size_t executed = 0;
+	size_t i = 0;
+	size_t next;
+	uint64_t k, limit;
+
+	for (;; ++i) {
+		const struct Op *op = &p->ops[i];
+		const size_t left = budget - executed;
+
+		// Every op other than OP_END takes at least one step
+		if (left == 0 && op->type != OP_END) goto deopt;
+
+		switch (op->type) {
+			case OP_ADD:
+				if (op->steps > left) goto deopt;
+				if (w->until == UNTIL_VALUE && c == w->cell) goto deopt;
+
+				value = (value + (uintmax_t)op->arg) & cell_mask;
+				vm_set_cell(vm, c, value);
+				executed += op->steps;
+				continue;
+			case OP_MOVE:
+				if (op->steps > left) goto deopt;
+
+				// Runs like >>< go both ways
+				if (w->until == UNTIL_POINTER && _lands_on(c, (op->arg == op->steps) ? 0 : -(int64_t)op->steps,
+						(op->arg == -(int64_t)op->steps) ? 0 : op->steps, w->cell, tape_size)) {
+					goto deopt;
+				}
+
+				c = _move(c, op->arg, tape_size);
+				value = vm_get_cell(vm, c);
+				executed += op->steps;
+				continue;
+			case OP_OUT:
+				if (w->until == UNTIL_OUTPUT) goto deopt;
+
+				StringCassette_put(&vm->output, value & 0xFF);
+				++*output_bytes;
+				break;
+			case OP_IN:
+				goto deopt;
+			case OP_JZ:
+				if (value == 0) i = op->target;
+				break;
+			case OP_JNZ:
+				if (value != 0) i = op->target;
+				break;
+			case OP_NOP:
+				break;
+			case OP_CLEAR:
+			case OP_MULADD:
+				if (value != 0) {
+					// The body runs until the counter wraps round to zero
+					k = (op->arg < 0) ? value : cell_mask - value + 1;
+					if (k > (left - 1) / (op->steps + 1)) goto deopt;
+					if (w->until != UNTIL_NONE && _watched(vm, open, op, c, w)) goto deopt;
+
+					for (uint32_t j=1; j <= op->target; ++j) {
+						const size_t d = _move(c, op[j].offset, tape_size);
+						vm_set_cell(vm, d, (vm_get_cell(vm, d) + (uintmax_t)op[j].arg * k) & cell_mask);
+					}
+
+					value = 0;
+					vm_set_cell(vm, c, 0);
+					executed += k * (op->steps + 1);
+				}
+
+				i += op->target;
+				break;
+			case OP_SCAN:
+				if (value != 0) {
+					if (left - 1 < op->steps + 1) goto deopt;
+
+					k = (left - 1) / (op->steps + 1);
+					limit = _scan_limit(w, c, op->arg, op->steps, tape_size);
+
+					if (limit == 0) goto deopt;
+					if (k > limit) k = limit;
+
+					if (!tape_scan(vm->tape, tape_size, vm->cell_size, &c, op->arg, &k)) {
+						// Out of budget part way through; carry on from the top
+						// of the body
+						executed += 1 + k * (op->steps + 1);
+						next = open + op->src + 1;
+						goto stop;
+					}
+
+					value = 0;
+					executed += k * (op->steps + 1);
+				}
+				break;
+			case OP_END:
+				next = open + p->source_length;
+				goto stop;
+		}
+
+		++executed;
+	}
+
+deopt:
+	next = open + p->ops[i].src;
+
+stop:
+	if (executed > 0) {
+		*ip = next;
+		*cell = c;
+	}
+
+	return executed;
+}
+
+size_t interpreter_run(struct BrainfuckVM *vm, size_t n) {
+	const uintmax_t cell_mask = VM_CELL_MASK(vm);
+	const uint64_t start_steps = vm->steps;
+	Trace *const trace = vm->trace;
+
+	// Work on local copies of the registers; they are written back at the end
+	size_t ip = vm->ip;
+	size_t cell = vm->current_cell;
+	uintmax_t value = vm_get_cell(vm, cell);
+	size_t executed = 0;
+	uint64_t output_bytes = 0;
+	size_t ran;
+	int in;
+
+	// What the VM is running until. The UI sets the cell and value first.
+	const struct Watch watch = {
+		.until = atomic_load_explicit(&vm->until, memory_order_acquire),
+		.cell = atomic_load_explicit(&vm->until_cell, memory_order_relaxed),
+		.value = atomic_load_explicit(&vm->until_value, memory_order_relaxed)
+	};
+
+	// Records the start of a basic block in the trace
+	#define TRACE_BLOCK() \
+		Trace_block(trace, start_steps + executed, ip, \
+			(ip < vm->program_length) ? vm->program[ip] : 0, cell, value)
+
+	// A breakpoint we're stopped at doesn't fire again as we leave it
+	const size_t resume_ip = vm->_at_break ? ip : SIZE_MAX;
+	vm->_at_break = false;
+
+	vm->status = INTERPRETER_OK;
+
+	if (Tier_ready(&vm->_tier)) _install(vm);
+
+	while (executed < n) {
+		if (ip >= vm->program_length) {
+			// Out of instructions; see if any more have been dispatched
+			if (_fetch(vm) == 0) {
+				vm->status = INTERPRETER_END;
+				break;
+			}
+
+			continue;
+		}
+
+		if (vm->_break_count > 0 && vm->_breaks[ip] && !(executed == 0 && ip == resume_ip)) {
+			vm->status = INTERPRETER_BREAK;
+			vm->stop_after = 0;
+			vm->_at_break = true;
+			break;
+		}
+
+		switch (vm->program[ip]) {
+			case '+':
+				value = (value + 1) & cell_mask;
+				vm_set_cell(vm, cell, value);
+
+				if (watch.until == UNTIL_VALUE && cell == watch.cell && value == watch.value) goto reached;
+				break;
+			case '-':
+				value = (value - 1) & cell_mask;
+				vm_set_cell(vm, cell, value);
+
+				if (watch.until == UNTIL_VALUE && cell == watch.cell && value == watch.value) goto reached;
+				break;
+			case '>':
+				if (cell < vm->tape_size-1)
+					++cell;
+				else
+					cell = 0;
+
+				value = vm_get_cell(vm, cell);
+
+				if (watch.until == UNTIL_POINTER && cell == watch.cell) goto reached;
+				break;
+			case '<':
+				if (cell > 0)
+					--cell;
+				else
+					cell = vm->tape_size - 1;
+
+				value = vm_get_cell(vm, cell);
+
+				if (watch.until == UNTIL_POINTER && cell == watch.cell) goto reached;
+				break;
+			case '.':
+				// TODO: figure out how to print multibyte chars
+				StringCassette_put(&vm->output, value & 0xFF);
+				++output_bytes;
+
+				if (watch.until == UNTIL_OUTPUT) goto reached;
+				break;
+			case ',':
+				if (watch.until == UNTIL_INPUT) goto stepped;
+
+				in = InputSource_getc(&vm->input);
+
+				if (in == INPUT_AGAIN) {
+					// Wait for the user to type some more input, or for a
+					// pipe to have some; this instruction is retried on
+					// the next run
+					vm->status = INTERPRETER_INPUT;
+					goto stop;
+				}
+
+				if (in != INPUT_EOF) {
+					value = in;
+				} else if (vm->eof_behaviour == EOF_ZERO) {
+					value = 0;
+				} else if (vm->eof_behaviour == EOF_NEGATIVE) {
+					value = cell_mask;
+				}
+
+				vm_set_cell(vm, cell, value);
+
+				// input can't be predicted, so the next instruction starts a
+				// new block
+				++ip;
+				++executed;
+				if (trace != NULL) TRACE_BLOCK();
+
+				if (watch.until == UNTIL_VALUE && cell == watch.cell && value == watch.value) goto stepped;
+				continue;
+			case '[':
+				if (value == 0) {
+					if (vm->_jumps[ip] == SIZE_MAX) {
+						// The end of this loop hasn't arrived yet; wait for it
+						if (_fetch(vm) == 0) {
+							vm->status = INTERPRETER_END;
+							goto stop;
+						}
+
+						continue;
+					}
+
+					// skip to the matching ]
+					ip = vm->_jumps[ip];
+				} else if (vm->_compiled[ip] != NULL && n - executed >= TIER_MIN_BUDGET
+						   && (ran = _run_compiled(vm, ip, &ip, &cell, n - executed, &output_bytes, &watch)) > 0) {
+					executed += ran;
+					value = vm_get_cell(vm, cell);
+					if (trace != NULL) TRACE_BLOCK();
+					continue;
+				} else if ((ran = _scan(vm, ip, &ip, &cell, n - executed, &watch)) > 0) {
+					executed += ran;
+					value = vm_get_cell(vm, cell);
+					if (trace != NULL) TRACE_BLOCK();
+					continue;
+				}
+
+				++ip;
+				++executed;
+				if (trace != NULL) TRACE_BLOCK();
+				continue;
+			case ']':
+				if (value != 0 && vm->_jumps[ip] != SIZE_MAX) {
+					const size_t open = vm->_jumps[ip];
+
+					if (vm->_compiled[open] != NULL && n - executed >= TIER_MIN_BUDGET
+					 && (ran = _run_compiled(vm, open, &ip, &cell, n - executed, &output_bytes, &watch)) > 0) {
+						executed += ran;
+						value = vm_get_cell(vm, cell);
+						if (trace != NULL) TRACE_BLOCK();
+						continue;
+					}
+
+					if ((ran = _scan(vm, open, &ip, &cell, n - executed, &watch)) > 0) {
+						executed += ran;
+						value = vm_get_cell(vm, cell);
+						if (trace != NULL) TRACE_BLOCK();
+						continue;
+					}
+
+					if (++vm->_heat[open] == TIER_THRESHOLD) _promote(vm, open);
+
+					// jump back to the matching [
+					ip = open;
+				}
+
+				++ip;
+				++executed;
+				if (trace != NULL) TRACE_BLOCK();
+				continue;
+		}
+
+		++ip;
+		++executed;
+	}
+
+	#undef TRACE_BLOCK
+
+	goto stop;
+
+reached:
+	++ip;
+	++executed;
+
+stepped:
+	// Got to what the VM was running until, unless the UI has changed it since
+	vm->status = INTERPRETER_UNTIL;
+	vm->stop_after = 0;
+	atomic_compare_exchange_strong(&vm->until, &(int){ watch.until }, UNTIL_NONE);
+
+stop:
+	vm->ip = ip;
+	vm->current_cell = cell;
+
+	// Only the thread running the VM writes the step count, so it doesn't
+	// need an atomic read-modify-write
+	atomic_store_explicit(&vm->steps, start_steps + executed, memory_order_release);
+
+	if (output_bytes > 0) {
+		atomic_store_explicit(&vm->output_bytes,
+			atomic_load_explicit(&vm->output_bytes, memory_order_relaxed) + output_bytes,
+			memory_order_relaxed);
+	}
+
+	return executed;
+}
+
+/*
+ * Helper function which runs a search of the tape the UI asked for. Returns
+ * the cell found, or SIZE_MAX.
+ */
+static size_t _query(struct BrainfuckVM *vm, int type, size_t from, uintmax_t value) {
+	Summary *const s = &vm->summary;
+	size_t found = SIZE_MAX;
+
+	// Searches need an up to date summary
+	Summary_refresh(s, vm->tape, SIZE_MAX);
+
+	// Each search wraps around to the other end of the tape if it has to
+	switch (type) {
+		case SNAPSHOT_QUERY_NEXT:
+			if ((found = Summary_next_nonzero(s, vm->tape, from)) == SIZE_MAX) {
+				found = Summary_next_nonzero(s, vm->tape, 0);
+			}
+			break;
+		case SNAPSHOT_QUERY_PREV:
+			if ((found = Summary_prev_nonzero(s, vm->tape, from)) == SIZE_MAX) {
+				found = Summary_prev_nonzero(s, vm->tape, vm->tape_size);
+			}
+			break;
+		case SNAPSHOT_QUERY_FIND:
+			if ((found = Summary_find(s, vm->tape, from, value)) == SIZE_MAX) {
+				found = Summary_find(s, vm->tape, 0, value);
+			}
+			break;
+	}
+
+	return found;
+}
+
+/*
+ * Helper function which publishes a snapshot of the VM for the UI. This
+ * copies at most SNAPSHOT_MAX_CELLS cells and SNAPSHOT_OUTPUT_TAIL bytes of
+ * output, re-counts at most SUMMARY_REFRESH_BLOCKS summary blocks, and never
+ * waits for the UI.
+ */
+static void _publish(struct BrainfuckVM *vm, size_t start, size_t cells, size_t minimap,
+					 unsigned query, size_t query_result) {
+	struct SnapshotFrame *f = Snapshot_begin(&vm->snapshot);
+	Summary *const s = &vm->summary;
+
+	if (start > vm->tape_size) start = vm->tape_size;
+	if (cells > vm->tape_size - start) cells = vm->tape_size - start;
+
+	f->valid = true;
+	f->steps = vm->steps;
+	f->current_cell = vm->current_cell;
+	f->window_start = start;
+	f->window_cells = cells;
+	memcpy(f->window, vm->tape + start * vm->cell_size, cells * vm->cell_size);
+	f->output_length = StringCassette_tail(&vm->output, SNAPSHOT_OUTPUT_TAIL, f->output);
+
+	// Each minimap column covers an equal share of the tape
+	Summary_refresh(s, vm->tape, SUMMARY_REFRESH_BLOCKS);
+	f->minimap_length = minimap;
+
+	for (size_t i=0; i < minimap; ++i) {
+		uint64_t total;
+		const uint64_t count = Summary_count(s, i * vm->tape_size / minimap,
+			(i + 1) * vm->tape_size / minimap, &total);
+
+		f->minimap[i] = (total > 0) ? count * 255 / total : 0;
+		if (count > 0 && f->minimap[i] == 0) f->minimap[i] = 1;
+	}
+
+	f->query = query;
+	f->query_result = query_result;
+
+	Snapshot_commit(&vm->snapshot);
+}
+
+size_t interpreter_prefix(struct BrainfuckVM *vm, size_t budget) {
+	const int stop_after = vm->stop_after;
+
+	atomic_store_explicit(&vm->until, UNTIL_INPUT, memory_order_release);
+	const size_t executed = interpreter_run(vm, budget);
+	vm->until = UNTIL_NONE;
+
+	// Only a breakpoint is a reason to stay paused
+	if (vm->status != INTERPRETER_BREAK) vm->stop_after = stop_after;
+	if (vm->status == INTERPRETER_UNTIL) vm->status = INTERPRETER_OK;
+
+	return executed;
+}
 
 int interpreter_thread(void *arg) {
-	const uintmax_t cell_mask = ~(~((uintmax_t)0) << (bfvm.cell_size * 8));
+	struct BrainfuckVM *vm = arg;
+
+	// For measuring idle time
+	uint64_t last_time = _now();
+	bool was_busy = true;
 
-	uintmax_t *cell = NULL;
+	// What the last snapshot showed
+	uint64_t published_time = 0;
+	uint64_t published_steps = UINT64_MAX;
+	size_t published_start = 0, published_cells = 0, published_minimap = 0;
+
+	// The last search of the tape which was answered
+	unsigned query = atomic_load_explicit(&vm->snapshot._query, memory_order_acquire);
+	size_t query_result = SIZE_MAX;
 
 	for (;;) {
-		if (bfvm.die) {
+		if (vm->die) {
 			return 0;
 		}
 
-		// If vm is not halted and there are instructions to execute
-		if (bfvm.stop_after != 0 && bfvm.instructionQueue.length > 0) {
-			uintmax_t tmp;
-
-			// Get the next instruction
-			char instruction = Queue_dequeue(&bfvm.instructionQueue);
-
-			// get pointer to cell
-			if (cell == NULL)
-				cell = (uintmax_t *)(bfvm.tape + (bfvm.current_cell * bfvm.cell_size));
-
-			switch (instruction) {
-				case '+':
-					tmp = *cell;
-					*cell &= ~cell_mask;  // clear out old value
-					*cell |= (tmp + 1) & cell_mask; 
-					break;
-				case '-':
-					tmp = *cell;
-					*cell &= ~cell_mask;
-					*cell |= (tmp - 1) & cell_mask;
-					break;
-				case '>':
-					if (bfvm.current_cell < bfvm.tape_size-1)
-						++bfvm.current_cell;
-					else
-						bfvm.current_cell = 0;
-
-					cell = NULL;
-					break;
-				case '<':
-					if (bfvm.current_cell > 0)
-						--bfvm.current_cell;
-					else
-						bfvm.current_cell = bfvm.tape_size - 1;
-					
-					cell = NULL;
-					break;
-				case '.':
-					// TODO: figure out how to print multibyte chars
-				case ',':
-					// TODO: add input method
-				case '[':
-				case ']':
-					// TODO: figure out how the fuck to do loops
-					break;
+		// Count the last iteration as idle if it didn't execute anything
+		const uint64_t now = _now();
+
+		if (!was_busy) {
+			atomic_store_explicit(&vm->idle_time,
+				atomic_load_explicit(&vm->idle_time, memory_order_relaxed) + (now - last_time),
+				memory_order_relaxed);
+		}
+
+		last_time = now;
+		was_busy = false;
+
+		bool waiting = false;
+		int stop_after = vm->stop_after;
+		int until = vm->until;
+		const uint64_t steps = vm->steps;
+		const uint64_t step_limit = vm->step_limit;
+
+		// Nothing runs between reading stop_after and steps, so this is
+		// exactly where the pause took effect
+		if (stop_after == 0 && vm->paused_at != steps) vm->paused_at = steps;
+
+		// If vm is not halted and hasn't reached its step limit
+		if (stop_after != 0 && steps < step_limit) {
+			// Run freely, or one instruction per tick while stepping. Check the
+			// controls less often while running until something happens.
+			size_t n = (stop_after > 0) ? 1 : (until != UNTIL_NONE) ? UNTIL_BATCH : RUN_BATCH;
+
+			if (step_limit - steps < n) n = step_limit - steps;
+
+			size_t executed = interpreter_run(vm, n);
+			was_busy = executed > 0;
+
+			// Decrement the stop_after count, unless the UI changed it in the
+			// meantime
+			if (stop_after > 0) {
+				atomic_compare_exchange_strong(&vm->stop_after, &stop_after, stop_after - (int)executed);
+			}
+
+			waiting = vm->status == INTERPRETER_INPUT;
+
+			// Stopping for any other reason ends running until something
+			// happens, so that the UI shows why
+			if (until != UNTIL_NONE && vm->status != INTERPRETER_OK && vm->status != INTERPRETER_UNTIL) {
+				atomic_compare_exchange_strong(&vm->until, &until, UNTIL_NONE);
 			}
+		}
+
+		// Answer any new search straight away
+		const unsigned asked = atomic_load_explicit(&vm->snapshot._query, memory_order_acquire);
+		bool answered = false;
+
+		if (asked != query) {
+			query = asked;
+			query_result = _query(vm,
+				atomic_load_explicit(&vm->snapshot._query_type, memory_order_relaxed),
+				atomic_load_explicit(&vm->snapshot._query_from, memory_order_relaxed),
+				atomic_load_explicit(&vm->snapshot._query_value, memory_order_relaxed));
+			answered = true;
+		}
+
+		// Publish a snapshot if anything the UI shows has changed, but no more
+		// often than SNAPSHOT_INTERVAL
+		const size_t start = atomic_load_explicit(&vm->snapshot._window_start, memory_order_relaxed);
+		const size_t cells = atomic_load_explicit(&vm->snapshot._window_cells, memory_order_relaxed);
+		const size_t minimap = atomic_load_explicit(&vm->snapshot._minimap_length, memory_order_relaxed);
+
+		// Nothing is shown while running until something happens
+		const bool changed = (vm->steps != published_steps || vm->summary._dirty_length > 0
+			|| start != published_start || cells != published_cells || minimap != published_minimap)
+			&& vm->until == UNTIL_NONE;
+
+		if (answered || (changed && _now() - published_time >= SNAPSHOT_INTERVAL)) {
+			_publish(vm, start, cells, minimap, query, query_result);
 
-			// One instruction has been executed; decrement the stop_after count
-			if (bfvm.stop_after > 0) --bfvm.stop_after;
+			published_time = _now();
+			published_steps = vm->steps;
+			published_start = start;
+			published_cells = cells;
+			published_minimap = minimap;
 		}
 
-		// Sleep if not in manual mode
-		if (bfvm.stop_after != -1) thrd_sleep(&bfvm.tick_delay, NULL);
+		if (waiting) {
+			// Poll for input more often than the tick delay
+			thrd_sleep(&(struct timespec){.tv_nsec=INPUT_POLL_DELAY}, NULL);
+		} else if (vm->stop_after != -1) {
+			// Sleep if not in manual mode
+			if (vm->skip_delay) {
+				thrd_yield();
+			} else {
+				thrd_sleep(&vm->tick_delay, NULL);
+			}
+		}
 	}
-	
+
 	return 0;
 }
-
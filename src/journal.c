@@ -0,0 +1,220 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+/*
+ * Helper function which writes an unsigned LEB128 varint.
+ */
+static void _Journal_put_varint(FILE *fp, uint64_t val) {
+	do {
+		uint8_t byte = val & 0x7F;
+		val >>= 7;
+
+		if (val != 0) byte |= 0x80;
+
+		putc(byte, fp);
+	} while (val != 0);
+}
+
+/*
+ * Helper function which reads an unsigned LEB128 varint from a journal
+ * being replayed. Returns -1 if the varint runs off the end of the journal.
+ */
+static int _Journal_get_varint(Journal *j, uint64_t *val) {
+	*val = 0;
+
+	for (unsigned shift=0; j->_pos < j->_length && shift < 64; shift += 7) {
+		uint8_t byte = j->_data[j->_pos++];
+		*val |= (uint64_t)(byte & 0x7F) << shift;
+
+		if (!(byte & 0x80)) return 0;
+	}
+
+	return -1;
+}
+
+/*
+ * Helper function which writes a single record.
+ */
+static void _Journal_write(Journal *j, enum JournalEventType type, uint64_t time, uint64_t steps, size_t n, const char *data) {
+	putc(type, j->_fp);
+	_Journal_put_varint(j->_fp, time - j->_last_time);
+	_Journal_put_varint(j->_fp, steps);
+
+	if (type == JOURNAL_BATCH || type == JOURNAL_INPUT) {
+		_Journal_put_varint(j->_fp, n);
+		fwrite(data, 1, n, j->_fp);
+	}
+
+	j->_last_time = time;
+}
+
+/*
+ * Helper function which writes out the pending batch, if there is one.
+ */
+static void _Journal_flush_batch(Journal *j) {
+	if (j->_batch_length == 0) return;
+
+	_Journal_write(j, JOURNAL_BATCH, j->_batch_time, j->_batch_steps, j->_batch_length, j->_batch);
+	j->_batch_length = 0;
+}
+
+uint64_t Journal_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int Journal_create(Journal *j, const char *path, const struct JournalHeader *hdr) {
+	memset(j, 0, sizeof(Journal));
+
+	if ((j->_fp = fopen(path, "wb")) == NULL) return -1;
+
+	j->_start = Journal_now();
+
+	fwrite(JOURNAL_MAGIC, 1, 4, j->_fp);
+	putc(JOURNAL_VERSION, j->_fp);
+	_Journal_put_varint(j->_fp, hdr->cell_size);
+	_Journal_put_varint(j->_fp, hdr->tape_size);
+	_Journal_put_varint(j->_fp, hdr->output_tape_size);
+	_Journal_put_varint(j->_fp, hdr->eof_behaviour);
+	putc(hdr->start_paused, j->_fp);
+
+	return ferror(j->_fp) ? -1 : 0;
+}
+
+int Journal_open(Journal *j, const char *path, struct JournalHeader *hdr) {
+	struct stat st;
+	int fd;
+
+	memset(j, 0, sizeof(Journal));
+
+	if ((fd = open(path, O_RDONLY)) == -1) return -1;
+
+	if (fstat(fd, &st) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	if (st.st_size < 5) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED) return -1;
+
+	j->_data = map;
+	j->_length = st.st_size;
+
+	if (memcmp(j->_data, JOURNAL_MAGIC, 4) != 0 || j->_data[4] != JOURNAL_VERSION) {
+		goto invalid;
+	}
+
+	j->_pos = 5;
+
+	if (_Journal_get_varint(j, &hdr->cell_size) == -1
+	 || _Journal_get_varint(j, &hdr->tape_size) == -1
+	 || _Journal_get_varint(j, &hdr->output_tape_size) == -1
+	 || _Journal_get_varint(j, &hdr->eof_behaviour) == -1
+	 || j->_pos >= j->_length) {
+		goto invalid;
+	}
+
+	hdr->start_paused = j->_data[j->_pos++];
+
+	return 0;
+
+invalid:
+	munmap((void *)j->_data, j->_length);
+	j->_data = NULL;
+	errno = EINVAL;
+	return -1;
+}
+
+void Journal_close(Journal *j) {
+	if (j->_fp != NULL) {
+		_Journal_flush_batch(j);
+		fclose(j->_fp);
+		j->_fp = NULL;
+	}
+
+	if (j->_data != NULL) {
+		munmap((void *)j->_data, j->_length);
+		j->_data = NULL;
+	}
+}
+
+int Journal_record(Journal *j, enum JournalEventType type, uint64_t steps, size_t n, const char *data) {
+	uint64_t time = Journal_now() - j->_start;
+
+	if (type == JOURNAL_BATCH) {
+		// Instructions dispatched before the interpreter has moved on are
+		// merged into the same batch
+		if (j->_batch_length > 0
+		 && (j->_batch_steps != steps || j->_batch_length + n > JOURNAL_BATCH_SIZE)) {
+			_Journal_flush_batch(j);
+		}
+
+		if (n > JOURNAL_BATCH_SIZE) {
+			// too big to ever be coalesced
+			_Journal_write(j, type, time, steps, n, data);
+		} else {
+			if (j->_batch_length == 0) {
+				j->_batch_time = time;
+				j->_batch_steps = steps;
+			}
+
+			memcpy(j->_batch + j->_batch_length, data, n);
+			j->_batch_length += n;
+		}
+	} else {
+		_Journal_flush_batch(j);
+		_Journal_write(j, type, time, steps, n, data);
+	}
+
+	return ferror(j->_fp) ? -1 : 0;
+}
+
+int Journal_next(Journal *j, struct JournalEvent *ev) {
+	uint64_t delta, length;
+
+	if (j->_pos >= j->_length) return 0;
+
+	ev->type = j->_data[j->_pos++];
+
+	if (ev->type < JOURNAL_BATCH || ev->type > JOURNAL_INPUT_EOF
+	 || _Journal_get_varint(j, &delta) == -1
+	 || _Journal_get_varint(j, &ev->steps) == -1) {
+		return -1;
+	}
+
+	j->_last_time += delta;
+	ev->time = j->_last_time;
+	ev->length = 0;
+	ev->data = NULL;
+
+	if (ev->type == JOURNAL_BATCH || ev->type == JOURNAL_INPUT) {
+		if (_Journal_get_varint(j, &length) == -1 || length > j->_length - j->_pos) {
+			return -1;
+		}
+
+		ev->length = length;
+		ev->data = (const char *)j->_data + j->_pos;
+		j->_pos += length;
+	}
+
+	return 1;
+}
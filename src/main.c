@@ -1,4 +1,6 @@
 #include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
 #include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -9,13 +11,21 @@
 #include <time.h>
 
 #include <ncurses.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
+#include "cache.h"
+#include "codegen.h"
+#include "journal.h"
+#include "program.h"
+#include "server.h"
 #include "ui.h"
 #include "queue.h"
 
 #define _NOEXTERN
 #include "interpreter.h"
+#include "stats.h"
 #undef _NOEXTERN
 
 #if defined(__STDC_NO_THREADS__) || defined(__STDC_NO_ATOMICS__)
@@ -29,12 +39,18 @@
 #define PANE_PROG	0x1
 #define PANE_OUT	0x2
 #define PANE_MEM	0x3
+#define PANE_STATS	0x4
+
+// height of the statistics pane
+#define STATS_PANE_HEIGHT	11
 
 // shorthand for thread sleep functions
 #define THRD_NANOSLEEP(ns) thrd_sleep(&(struct timespec){.tv_nsec=ns}, NULL)
 #define THRD_SLEEP(s) thrd_sleep(&(struct timespec){.tv_sec=s}, NULL)
 
-#define KEY_CTRL(key) ((key) & 0x1F)
+// how long (in us) a replay waits on a VM which makes no progress before
+// applying the next event anyway
+#define REPLAY_STALL_TIMEOUT	1000000
 
 // TODO: should this be atomic?
 struct BrainfuckVM bfvm = {
@@ -47,39 +63,456 @@ struct BrainfuckVM bfvm = {
 
 	.stop_after = -1,
 	.tick_delay = { .tv_sec = 0, .tv_nsec = 250000000 },
-	.die = false
+	.die = false,
+
+	.steps = 0,
+	.step_limit = UINT64_MAX,
+
+	.eof_behaviour = EOF_UNCHANGED,
+
+	.trace = NULL
 };
 
+struct Stats stats = { 0 };
+struct MemView memview = { 0 };
+
+/*
+ * Records the VM's current state in the trace, so that the steps since the
+ * start of the last basic block can be reconstructed. The interpreter thread
+ * must not be running.
+ */
+void trace_checkpoint() {
+	if (bfvm.trace == NULL) return;
+
+	Trace_block(bfvm.trace, bfvm.steps, bfvm.ip,
+		(bfvm.ip < bfvm.program_length) ? bfvm.program[bfvm.ip] : 0,
+		bfvm.current_cell, vm_get_cell(&bfvm, bfvm.current_cell));
+}
+
 void reset_vm() {
 	// Reset the vm to startup settings
-	// free resources
-	free(bfvm.tape);
-	Queue_free(&bfvm.instructionQueue);
-	StringCassette_free(&bfvm.output);
+	interpreter_reset(&bfvm);
+}
 
-	bfvm.current_cell = 0;
-	bfvm.die = false;
+void restart_vm() {
+	// kill the interpreter thread
+	bfvm.die = true;
+	thrd_join(bfvm.interpreter_thread, NULL);
 
-	StringCassette_init(&bfvm.output, bfvm.output_tape_size);
-	Queue_init(&bfvm.instructionQueue);
+	// reset the interpreter
+	reset_vm();
 
-	bfvm.tape = calloc(bfvm.tape_size, bfvm.cell_size);
+	// start a new interpreter thread
+	thrd_create(&bfvm.interpreter_thread, interpreter_thread, &bfvm);
+}
+
+/* Session recording & replay */
+// The journal being recorded to, or NULL if not recording
+Journal *recording = NULL;
+
+// Whether a pause from F2 is waiting for the interpreter to stop
+bool pause_pending = false;
+
+// The journal being replayed
+Journal replay_journal;
+bool replaying = false;
+struct JournalEvent replay_next;  // the next event to be applied
+uint64_t replay_start;  // when the replay started
+uint64_t replay_stall_steps, replay_stall_time;  // progress watchdog
+
+/*
+ * Records a pause asked for with F2 once the interpreter has actually
+ * stopped, at the step it stopped on.
+ */
+void record_pause() {
+	if (pause_pending && bfvm.paused_at != UINT64_MAX) {
+		Journal_record(recording, JOURNAL_PAUSE, bfvm.paused_at, 0, NULL);
+		pause_pending = false;
+	}
+}
+
+/*
+ * Records an event to the session journal, if one is being recorded.
+ */
+void record_event(enum JournalEventType type, size_t n, const char *data) {
+	if (recording != NULL) {
+		record_pause();
+
+		// A pause which hasn't taken effect by the time the VM is resumed
+		// never happened
+		if (type == JOURNAL_RESUME) pause_pending = false;
+
+		Journal_record(recording, type, bfvm.steps, n, data);
+	}
+}
+
+/*
+ * Applies an event from a journal to the VM
+ */
+void apply_journal_event(const struct JournalEvent *ev) {
+	switch (ev->type) {
+		case JOURNAL_BATCH:
+			Queue_enqueue_all(&bfvm.instructionQueue, ev->length, (char *)ev->data);
+			break;
+		case JOURNAL_PAUSE:
+			bfvm.stop_after = 0;
+			break;
+		case JOURNAL_RESUME:
+			bfvm.stop_after = -1;
+			break;
+		case JOURNAL_RESET:
+			restart_vm();
+			break;
+		case JOURNAL_INPUT:
+			InputSource_push(&bfvm.input, ev->length, ev->data);
+			break;
+		case JOURNAL_INPUT_EOF:
+			InputSource_close(&bfvm.input);
+			break;
+	}
+}
+
+/*
+ * Reads the next event of the replay and holds the interpreter at the step
+ * it was recorded at. Ends the replay at the end of the journal.
+ */
+void replay_advance() {
+	if (Journal_next(&replay_journal, &replay_next) == 1) {
+		bfvm.step_limit = replay_next.steps;
+	} else {
+		// end of journal (or a corrupt record); hand control back to the user
+		replaying = false;
+		bfvm.step_limit = UINT64_MAX;
+		Journal_close(&replay_journal);
+	}
+
+	replay_stall_steps = bfvm.steps;
+	replay_stall_time = Journal_now();
+}
+
+/*
+ * Applies every replay event which is due. An event is due once the VM has
+ * executed as many instructions as it had when the event was recorded, and
+ * (when paced) once as much time has passed as had during the recording.
+ *
+ * paced	Whether to wait for each event's timestamp
+ */
+void replay_poll(bool paced) {
+	while (replaying) {
+		uint64_t now = Journal_now();
+
+		if (paced && now - replay_start < replay_next.time) return;
+
+		if (bfvm.steps < replay_next.steps) {
+			// Waiting on the interpreter. Give up on it if its stuck, so that
+			// an inconsistent journal can't hang the replay forever
+			if (bfvm.steps != replay_stall_steps) {
+				replay_stall_steps = bfvm.steps;
+				replay_stall_time = now;
+				return;
+			} else if (now - replay_stall_time < REPLAY_STALL_TIMEOUT) {
+				return;
+			}
+		}
+
+		// Hold the interpreter while the event is applied, in case it resets
+		// the step count
+		bfvm.step_limit = 0;
+		apply_journal_event(&replay_next);
+		replay_advance();
+	}
+}
+
+/* Compiled program cache */
+bool use_cache = true;
+bool cache_keyed = false;  // whether cache_key is for the loaded program
+CacheKey cache_key;
+size_t cache_length;  // the length of the program cache_key is for
+size_t cache_loops;  // the number of compiled loops in the cache file
+
+/*
+ * Loads a program file into the VM. Regular files go through the compiled
+ * program cache, so a program which has been loaded before doesn't have to
+ * be parsed again. The interpreter thread must not be running.
+ *
+ * path		The file to load
+ *
+ * Returns 0 on success. Returns -1 and sets errno on failure.
+ */
+int load_program(const char *path) {
+	FILE *fp = fopen(path, "r");
+	char buf[65536];
+	struct stat st;
+	size_t n;
+
+	if (fp == NULL) return -1;
+
+	if (use_cache && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		char *src = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+
+		if (src != MAP_FAILED) {
+			fclose(fp);
+			Cache_key(&cache_key, st.st_size, src, &bfvm);
+			cache_keyed = true;
+
+			if (Cache_load(&bfvm, &cache_key) == 0) {
+				cache_length = bfvm.program_length;
+				cache_loops = Cache_compiled_loops(&bfvm);
+			} else if (interpreter_load(&bfvm, st.st_size, src) == 0) {
+				// Failing to save just means parsing again next time
+				cache_length = bfvm.program_length;
+				cache_loops = 0;
+				Cache_save(&bfvm, &cache_key);
+			} else {
+				munmap(src, st.st_size);
+				return -1;
+			}
+
+			// The journal still gets the source as it was written
+			for (size_t i=0; i < (size_t)st.st_size; i += n) {
+				n = ((size_t)st.st_size - i < sizeof(buf)) ? (size_t)st.st_size - i : sizeof(buf);
+				record_event(JOURNAL_BATCH, n, src + i);
+			}
+
+			munmap(src, st.st_size);
+			return 0;
+		}
+	}
+
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+		if (interpreter_load(&bfvm, n, buf) != 0) {
+			fclose(fp);
+			return -1;
+		}
+
+		record_event(JOURNAL_BATCH, n, buf);
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/*
+ * Runs the part of the loaded program which doesn't depend on its input, so
+ * that it starts from there. The result is cached along with the program,
+ * unless a trace is being recorded, which needs every step to be run.
+ *
+ * budget	The most instructions to run
+ */
+void run_prefix(uint64_t budget) {
+	if (cache_keyed && bfvm.trace == NULL && Cache_load_prefix(&bfvm, &cache_key, budget) == 0) return;
+
+	interpreter_prefix(&bfvm, budget);
+
+	// Failing to save just means running it again next time
+	if (cache_keyed) Cache_save_prefix(&bfvm, &cache_key, budget);
+}
+
+/*
+ * Compiles a program file ahead of time, to C source if out_path ends in .c
+ * and to an executable otherwise. The generated code uses the VM's current
+ * cell size, tape size and EOF behaviour.
+ *
+ * path		The program to compile
+ * out_path	The file to create
+ *
+ * Returns the exit status for main.
+ */
+int compile_program(const char *path, const char *out_path) {
+	const struct CodegenOptions opt = {
+		.cell_size = bfvm.cell_size,
+		.tape_size = bfvm.tape_size,
+		.eof_behaviour = bfvm.eof_behaviour
+	};
+	const size_t out_len = strlen(out_path);
+	Program program;
+	int result;
+
+	// Compiling should only write out_path, not a cache file as well
+	use_cache = false;
+
+	if (load_program(path) != 0) {
+		perror(path);
+		return 1;
+	}
+
+	if (Program_compile(&program, bfvm.program_length, bfvm.program, bfvm.tape_size, PROGRAM_OPTIMISE) != 0) {
+		perror("Unable to compile program");
+		return 1;
+	}
+
+	if (out_len > 2 && strcmp(out_path + out_len - 2, ".c") == 0) {
+		FILE *fp = fopen(out_path, "w");
+
+		if (fp == NULL) {
+			perror(out_path);
+			Program_free(&program);
+			return 1;
+		}
+
+		result = codegen_c(&program, fp, &opt);
+		result = (fclose(fp) != 0) ? -1 : result;
+	} else {
+		errno = 0;
+		result = codegen_executable(&program, out_path, &opt);
+	}
+
+	if (result != 0) {
+		if (errno != 0)
+			perror(out_path);
+		else
+			fprintf(stderr, "%s: The C compiler failed\n", out_path);
+	}
+
+	Program_free(&program);
+	interpreter_unload(&bfvm);
+
+	return (result == 0) ? 0 : 1;
+}
+
+// The server, when running headless
+Server server;
+
+/*
+ * Asks the server to shut down
+ */
+void stop_server(int sig) {
+	(void)sig;
+	bfvm.die = true;
+	Server_wake(&server);
+}
+
+/*
+ * Serves the VM on a Unix socket instead of showing the UI, until a client
+ * tells it to stop or the process is interrupted. The interpreter thread
+ * must not be running.
+ *
+ * path		Where to create the socket
+ *
+ * Returns the exit status for main.
+ */
+int serve(const char *path) {
+	if (Server_open(&server, path) != 0) {
+		perror(path);
+		return 1;
+	}
+
+	// Clients can load other programs, which mustn't end up cached as this one
+	cache_keyed = false;
+
+	signal(SIGINT, stop_server);
+	signal(SIGTERM, stop_server);
+
+	const int result = Server_run(&server, &bfvm);
+	if (result != 0) perror(path);
+
+	Server_close(&server);
+
+	return (result == 0) ? 0 : 1;
+}
+
+/*
+ * Starts running the VM until the condition typed into the UI is met. Writes
+ * a description of the condition to text. Returns 0 on success, or -1 if the
+ * condition doesn't make sense.
+ */
+int run_until(const char *cond, char *text, size_t text_size) {
+	char *end;
+	uintmax_t cell, value;
+	int until;
+
+	if (*cond == '\0') {
+		until = UNTIL_BREAK;
+		snprintf(text, text_size, "a breakpoint");
+	} else if (strcmp(cond, ".") == 0) {
+		until = UNTIL_OUTPUT;
+		snprintf(text, text_size, "output");
+	} else if (strcmp(cond, ",") == 0) {
+		until = UNTIL_INPUT;
+		snprintf(text, text_size, "input");
+	} else if (*cond == '@') {
+		cell = strtoumax(cond + 1, &end, 0);
+		if (end == cond + 1 || *end != '\0' || cell >= bfvm.tape_size) return -1;
+
+		until = UNTIL_POINTER;
+		bfvm.until_cell = cell;
+		snprintf(text, text_size, "cell %ju", cell);
+	} else {
+		cell = strtoumax(cond, &end, 0);
+		if (end == cond || *end != '=' || cell >= bfvm.tape_size) return -1;
+
+		const char *v = end + 1;
+		value = strtoumax(v, &end, 0);
+		if (end == v || *end != '\0' || value > VM_CELL_MASK(&bfvm)) return -1;
+
+		until = UNTIL_VALUE;
+		bfvm.until_cell = cell;
+		bfvm.until_value = value;
+		snprintf(text, text_size, "cell %ju = %ju", cell, value);
+	}
+
+	// The cell and value have to be set before the interpreter sees this
+	atomic_store_explicit(&bfvm.until, until, memory_order_release);
+	bfvm.stop_after = -1;
+
+	return 0;
 }
 
 void print_help(char *prgname) {
-	printf("Usage: %s [-hPR] [-c SIZE] [-d TIME] [-m SIZE] [-O SIZE] [FILE]\n\n", prgname);
+	printf("Usage: %s [-hNPx] [-C OUT] [-c SIZE] [-d TIME] [-e MODE] [-i FILE] [-m SIZE] [-O SIZE] [-p MAX] [-S PATH] [-s FILE] [-t FILE] [-R FILE | -r FILE] [FILE]\n\n", prgname);
 
 	printf("Options:\n");
+	printf("  -C OUT \tCompile FILE ahead of time and exit. If OUT ends in .c\n"
+		   "         \tC source is written, otherwise an executable is built\n"
+		   "         \twith $CC (default cc). The result honours -c, -e and -m.\n");
 	printf("  -c SIZE\tSet the cell size in bytes. This must be an integer\n"
 		   "         \tbetween 1 and %zd. Default is 1.\n", sizeof(uintmax_t));
 	printf("  -d TIME\tSet the interpreter tick delay. This determines how\n"
 		   "         \tlong the interpreter pauses between executing each\n"
 		   "         \tinstruction. Default is 250ms.\n");
+	printf("  -e MODE\tSet what , does once input runs out. MODE is one of\n"
+		   "         \t'keep' (leave the cell unchanged), '0' or '-1'.\n"
+		   "         \tDefault is keep.\n");
 	printf("  -h     \tDisplay this help message.\n");
+	printf("  -i FILE\tRead program input from FILE. Use - for stdin. By\n"
+		   "         \tdefault input is typed into the UI (F3).\n");
 	printf("  -m SIZE\tSet the length of the memory tape. Default is 1024.\n");
+	printf("  -N     \tDon't use the compiled program cache. Programs loaded\n"
+		   "         \tfrom FILE are normally cached in ~/.cache/bfdbg (or\n"
+		   "         \t$XDG_CACHE_HOME/bfdbg), along with their hot loops\n"
+		   "         \tonce compiled, so that loading them again is quicker.\n");
 	printf("  -O SIZE\tSet the max length of the output buffer. Default is 4096.\n");
 	printf("  -P     \tAutomatically pause the interpreter.\n");
-	printf("  -R     \tRecord program input to FILE.\n");
+	printf("  -p MAX \tStart FILE from its first , instead of the beginning.\n"
+		   "         \tThe instructions before it (at most MAX of them) are\n"
+		   "         \trun while loading, and the result is cached.\n");
+	printf("  -S PATH\tRun headless, controlled by clients connected to the\n"
+		   "         \tUnix socket PATH (see bfclient), instead of showing\n"
+		   "         \tthe UI.\n");
+	printf("  -s FILE\tAppend runtime statistics to FILE as JSON lines, once\n"
+		   "         \tper second.\n");
+	printf("  -t FILE\tWrite an execution trace to FILE. Use bftrace to read it.\n");
+	printf("  -R FILE\tRecord the session to the journal FILE.\n");
+	printf("  -r FILE\tReplay the session recorded in the journal FILE. The\n"
+		   "         \tjournal's settings and program are used. Program input\n"
+		   "         \tfrom -i must be given again.\n");
+	printf("  -x     \tReplay at maximum speed instead of the recorded pace.\n\n");
+
+	printf("A # in the program sets a breakpoint on the instruction after it. The\n"
+		   "interpreter pauses when it gets there; press F2 to carry on.\n\n");
+
+	printf("In the memory pane, PgUp, PgDn and Home scroll through the tape, Tab\n"
+		   "and Shift-Tab jump to the next and previous non-zero cells, and / finds\n"
+		   "a value (decimal, or hex with 0x).\n\n");
+
+	printf("F4 runs the program at full speed, without updating the panes, until:\n"
+		   "  (nothing)\ta breakpoint or the end of the program\n"
+		   "  .        \tthe next output\n"
+		   "  ,        \tthe next input, before it is read\n"
+		   "  @CELL    \tthe pointer moves onto CELL\n"
+		   "  CELL=VAL \tCELL is set to VAL\n"
+		   "It also stops at breakpoints and when the program waits for input.\n"
+		   "F2 stops it early.\n");
 }
 
 /*
@@ -110,14 +543,32 @@ unsigned long long get_uint_arg(unsigned long long min_val, unsigned long long m
 int main(int argc, char *argv[]) {
 	/* Init */
 	int ch;
+	char *input_path = NULL;
+	char *record_path = NULL;
+	char *compile_path = NULL;
+	char *trace_path = NULL;
+	FILE *stats_file = NULL;
+	char *replay_path = NULL;
+	char *server_path = NULL;
+	uint64_t prefix_budget = 0;
+	bool replay_fast = false;
+	int status = 0;
+
+	Journal record_journal;
+	Trace trace;
+	struct JournalHeader journal_header;
 
 	/* Parse command line args */
-	while ((ch = getopt(argc, argv, "c:d:hm:O:PR")) != -1) {
+	while ((ch = getopt(argc, argv, "C:c:d:e:hi:m:NO:Pp:S:s:t:R:r:x")) != -1) {
 		switch (ch) {
 			case 'h':
 				// Print help
 				print_help(argv[0]);
 				return 0;
+			case 'C':
+				// Compile ahead of time
+				compile_path = optarg;
+				break;
 			case 'c':
 				// Set cell size
 				bfvm.cell_size = get_uint_arg(1, sizeof(uintmax_t));
@@ -133,6 +584,23 @@ int main(int argc, char *argv[]) {
 				// it should also accept some aliased values, such as 'slow',
 				// 'normal', and 'fast'
 				break;
+			case 'e':
+				// Set EOF behaviour
+				if (strcmp(optarg, "keep") == 0) {
+					bfvm.eof_behaviour = EOF_UNCHANGED;
+				} else if (strcmp(optarg, "0") == 0) {
+					bfvm.eof_behaviour = EOF_ZERO;
+				} else if (strcmp(optarg, "-1") == 0) {
+					bfvm.eof_behaviour = EOF_NEGATIVE;
+				} else {
+					goto handle_invalid_arg;
+				}
+
+				break;
+			case 'i':
+				// Set input file
+				input_path = optarg;
+				break;
 			case 'm':
 				// Set memory tape length
 				bfvm.tape_size = get_uint_arg(1, SIZE_MAX);
@@ -141,6 +609,10 @@ int main(int argc, char *argv[]) {
 					goto handle_invalid_arg;
 				}
 
+				break;
+			case 'N':
+				// Don't use the compiled program cache
+				use_cache = false;
 				break;
 			case 'O':
 				// Set output tape length
@@ -155,7 +627,42 @@ int main(int argc, char *argv[]) {
 				// Start paused
 				bfvm.stop_after = 0;
 				break;
+			case 'p':
+				// Run the start of the program while loading it
+				prefix_budget = get_uint_arg(1, SIZE_MAX);
+
+				if (errno == EINVAL) {
+					goto handle_invalid_arg;
+				}
+
+				break;
+			case 'S':
+				// Serve the debugger on a socket
+				server_path = optarg;
+				break;
+			case 's':
+				// Dump statistics
+				if ((stats_file = fopen(optarg, "a")) == NULL) {
+					perror(optarg);
+					return 1;
+				}
+
+				break;
+			case 't':
+				// Trace execution
+				trace_path = optarg;
+				break;
 			case 'R':
+				// Record session
+				record_path = optarg;
+				break;
+			case 'r':
+				// Replay session
+				replay_path = optarg;
+				break;
+			case 'x':
+				// Replay at maximum speed
+				replay_fast = true;
 				break;
 			default:
 				// Unrecognised option
@@ -167,34 +674,162 @@ int main(int argc, char *argv[]) {
 		}
 	}
 
+	if (compile_path != NULL) {
+		if (optind >= argc) {
+			fprintf(stderr, "-C requires a FILE to compile\n");
+			return 1;
+		}
+
+		return compile_program(argv[optind], compile_path);
+	}
+
+	if (record_path != NULL && replay_path != NULL) {
+		fprintf(stderr, "-R and -r cannot be used together\n");
+		return 1;
+	}
+
+	if (prefix_budget > 0 && (record_path != NULL || replay_path != NULL)) {
+		// Journals are replayed from the very start of the program
+		fprintf(stderr, "-p cannot be used with -R or -r\n");
+		return 1;
+	}
+
+	if (server_path != NULL && (record_path != NULL || replay_path != NULL)) {
+		fprintf(stderr, "-S cannot be used with -R or -r\n");
+		return 1;
+	}
+
+	if (replay_path != NULL) {
+		if (optind < argc) {
+			fprintf(stderr, "A FILE cannot be loaded while replaying; the journal contains the program\n");
+			return 1;
+		}
+
+		if (Journal_open(&replay_journal, replay_path, &journal_header) != 0) {
+			perror(replay_path);
+			return 1;
+		}
+
+		// Use the settings the journal was recorded with
+		if (journal_header.cell_size < 1 || journal_header.cell_size > sizeof(uintmax_t)
+		 || journal_header.tape_size < 1 || journal_header.output_tape_size < 1
+		 || journal_header.eof_behaviour > EOF_NEGATIVE) {
+			fprintf(stderr, "%s: Invalid journal settings\n", replay_path);
+			return 1;
+		}
+
+		bfvm.cell_size = journal_header.cell_size;
+		bfvm.tape_size = journal_header.tape_size;
+		bfvm.output_tape_size = journal_header.output_tape_size;
+		bfvm.eof_behaviour = journal_header.eof_behaviour;
+		bfvm.stop_after = journal_header.start_paused ? 0 : -1;
+	}
+
+	if (record_path != NULL) {
+		journal_header = (struct JournalHeader){
+			.cell_size = bfvm.cell_size,
+			.tape_size = bfvm.tape_size,
+			.output_tape_size = bfvm.output_tape_size,
+			.eof_behaviour = bfvm.eof_behaviour,
+			.start_paused = bfvm.stop_after == 0
+		};
+
+		if (Journal_create(&record_journal, record_path, &journal_header) != 0) {
+			perror(record_path);
+			return 1;
+		}
+
+		recording = &record_journal;
+	}
+
+	if (trace_path != NULL) {
+		if (Trace_create(&trace, trace_path, bfvm.cell_size, bfvm.tape_size) != 0) {
+			perror(trace_path);
+			return 1;
+		}
+
+		bfvm.trace = &trace;
+	}
+
 	/* Start interpreter thread */
 	StringCassette_init(&bfvm.output, bfvm.output_tape_size);
 	Queue_init(&bfvm.instructionQueue);
 
 	bfvm.tape = calloc(bfvm.tape_size, bfvm.cell_size);
 
+	if (Snapshot_init(&bfvm.snapshot, bfvm.cell_size, SNAPSHOT_MAX_CELLS) != 0
+	 || Summary_init(&bfvm.summary, bfvm.tape_size, bfvm.cell_size) != 0) {
+		perror("malloc");
+		return 1;
+	}
+
+	if (input_path != NULL) {
+		if (InputSource_open(&bfvm.input, input_path) != 0) {
+			perror(input_path);
+			return 1;
+		}
+	} else {
+		InputSource_init_interactive(&bfvm.input);
+	}
+
 	// alloc tape (zero-initialized)
 	if (optind < argc) {
 		// FILE positional argument specified
-
-		FILE *fp = fopen(argv[optind], "r");
-		char buf[256];
-
-		while (fgets(buf, 256, fp) != NULL) {
-			Queue_enqueue_all(&bfvm.instructionQueue, strlen(buf), buf);
+		if (load_program(argv[optind]) != 0) {
+			perror(argv[optind]);
+			return 1;
 		}
 
-		fclose(fp);
+		if (prefix_budget > 0) run_prefix(prefix_budget);
 	} else {
 		// FILE not specified
 	}
 
-	thrd_create(&bfvm.interpreter_thread, interpreter_thread, NULL);
+	if (server_path != NULL) {
+		// The server runs the VM itself
+		status = serve(server_path);
+		goto cleanup;
+	}
+
+	if (replay_path != NULL) {
+		// hold the interpreter until the first event
+		replaying = true;
+		replay_start = Journal_now();
+		replay_advance();
+	}
+
+	thrd_create(&bfvm.interpreter_thread, interpreter_thread, &bfvm);
+
+	if (replaying && replay_fast) {
+		// Run through the whole journal before handing over to the user. The
+		// tick delay is skipped so a paused interpreter notices resumes
+		// immediately
+		bfvm.skip_delay = true;
+
+		while (replaying) {
+			replay_poll(false);
+			thrd_yield();
+		}
+
+		bfvm.skip_delay = false;
+	}
 
 	/* Create ncurses ui */
 	ESCDELAY = 10;
 
-	initscr();
+	if (input_path != NULL && strcmp(input_path, "-") == 0) {
+		// stdin is being used for program input, so take keyboard input
+		// from the terminal directly
+		FILE *tty = fopen("/dev/tty", "r+");
+
+		if (tty == NULL || newterm(NULL, stdout, tty) == NULL) {
+			fprintf(stderr, "Unable to open the terminal\n");
+			return 1;
+		}
+	} else {
+		initscr();
+	}
+
 	cbreak();
 	noecho();
 	keypad(stdscr, TRUE);
@@ -203,14 +838,30 @@ int main(int argc, char *argv[]) {
 
 	refresh();
 
-	// Create UI panes
+	// Create UI panes. The bottom line of the screen is kept free for the
+	// line editor.
+	const int pane_lines = LINES - 1;
+
+	const int left_lines = pane_lines - STATS_PANE_HEIGHT;
+
 	Pane *panes[] = {
-		create_pane(PANE_PROG, LINES / 2, COLS / 2, 0, 0, "Program", NULL),
-		create_pane(PANE_OUT, LINES / 2, COLS / 2, LINES / 2, 0, "Output", OutPaneRenderer),
-		create_pane(PANE_MEM, LINES, COLS / 2, 0, COLS / 2, "Memory", MemPaneRenderer),
+		create_pane(PANE_PROG, left_lines / 2, COLS / 2, 0, 0, "Program", NULL),
+		create_pane(PANE_OUT, left_lines - left_lines / 2, COLS / 2, left_lines / 2, 0, "Output", OutPaneRenderer),
+		create_pane(PANE_MEM, pane_lines, COLS / 2, 0, COLS / 2, "Memory", MemPaneRenderer),
+		create_pane(PANE_STATS, STATS_PANE_HEIGHT, COLS / 2, left_lines, 0, "Stats", StatsPaneRenderer),
 		NULL
 	};	
 
+	// Line editor used to type program input, searches and run until
+	// conditions
+	LineEditor line_editor = { .active = false };
+	enum { EDIT_INPUT, EDIT_FIND, EDIT_UNTIL } editing = EDIT_INPUT;
+
+	// What the VM is running until, and since when
+	char until_text[64] = "";
+	uint64_t until_steps = 0, until_time = 0;
+	bool running_until = false;
+
 	scrollok(panes[1]->window, TRUE);
 
 	/* Mainloop */
@@ -218,14 +869,112 @@ int main(int argc, char *argv[]) {
 		clock_t loop_start = clock();
 		
 		/* Render */
-		for (size_t i=0; panes[i] != NULL; ++i) {
-			render_pane(panes[i]);
+		if (bfvm.until != UNTIL_NONE) {
+			// Running until something happens; the panes are left alone and
+			// only the progress is shown
+			mvprintw(LINES - 1, 0, "Running until %s: %" PRIu64 " steps, %.1f s (F2 to stop)",
+				until_text, bfvm.steps - until_steps, (Stats_now() - until_time) / 1e6);
+			clrtoeol();
+			refresh();
+		} else {
+			if (running_until) {
+				// Got there; the interpreter paused the VM, so let the journal
+				// know it should too
+				running_until = false;
+				if (bfvm.stop_after == 0) record_event(JOURNAL_PAUSE, 0, NULL);
+			}
+
+			for (size_t i=0; panes[i] != NULL; ++i) {
+				render_pane(panes[i]);
+			}
+		}
+
+		/* Statistics */
+		if (Stats_now() - stats.time >= STATS_INTERVAL) {
+			Stats_sample(&stats, &bfvm, panes, 1000000 / FRAMERATE);
+
+			if (stats_file != NULL) Stats_write_json(&stats, stats_file);
 		}
 
+		// Prompt for input when the program is waiting on it
+		if (!line_editor.active && bfvm.input.type == INPUT_INTERACTIVE
+		 && InputSource_starved(&bfvm.input)) {
+			LineEditor_open(&line_editor, "Input: ");
+		}
+
+		if (!running_until) LineEditor_render(&line_editor, stdscr, LINES - 1);
+
+		/* Recording */
+		record_pause();
+
+		/* Replay */
+		replay_poll(true);
+
 		/* Handle Key Events */
 		do {  // do ensures that key events do eventually get processed even if
 			  // rendering takes the full frame time
-			if ((ch = getch()) != ERR) {
+			if ((ch = getch()) != ERR && line_editor.active) {
+				// The line editor has focus; send keys to it
+				switch (LineEditor_handle_key(&line_editor, ch)) {
+					case LINE_EDITOR_SUBMIT:
+						if (editing == EDIT_UNTIL) {
+							line_editor.buffer[line_editor.length] = '\0';
+
+							if (run_until(line_editor.buffer, until_text, sizeof(until_text)) == 0) {
+								record_event(JOURNAL_RESUME, 0, NULL);
+								until_steps = bfvm.steps;
+								until_time = Stats_now();
+								running_until = true;
+							} else {
+								flash();
+							}
+
+							line_editor.active = false;
+							editing = EDIT_INPUT;
+							break;
+						}
+
+						if (editing == EDIT_FIND) {
+							// search the tape for a value, after the first cell
+							// shown so that searching again finds the next one
+							char *end;
+							line_editor.buffer[line_editor.length] = '\0';
+							uintmax_t value = strtoumax(line_editor.buffer, &end, 0);
+
+							if (end != line_editor.buffer && *end == '\0' && value <= VM_CELL_MASK(&bfvm)) {
+								memview.query = Snapshot_query(&bfvm.snapshot, SNAPSHOT_QUERY_FIND,
+									memview.start + 1, value);
+							} else {
+								flash();
+							}
+
+							line_editor.active = false;
+							editing = EDIT_INPUT;
+							break;
+						}
+
+						// enter inserts a newline into the program's input
+						line_editor.buffer[line_editor.length++] = '\n';
+						InputSource_push(&bfvm.input, line_editor.length, line_editor.buffer);
+						record_event(JOURNAL_INPUT, line_editor.length, line_editor.buffer);
+						line_editor.active = false;
+						break;
+					case LINE_EDITOR_CANCEL:
+						editing = EDIT_INPUT;
+						break;
+					case LINE_EDITOR_EOF:
+						if (editing != EDIT_INPUT) {
+							line_editor.active = false;
+							editing = EDIT_INPUT;
+							break;
+						}
+
+						InputSource_close(&bfvm.input);
+						record_event(JOURNAL_INPUT_EOF, 0, NULL);
+						line_editor.active = false;
+						break;
+				}
+			} else if (ch != ERR) {
 				switch (ch) {
 					case 27:  // ALT or ESC
 						if ((ch = getch()) != ERR) {
@@ -236,21 +985,59 @@ int main(int argc, char *argv[]) {
 						}
 						break;
 					case KEY_F(2):
-						// pause/resume interpreter
-						bfvm.stop_after = bfvm.stop_after ? 0 : -1;
+						// pause/resume interpreter, which also stops running
+						// until something happens
+						bfvm.until = UNTIL_NONE;
+						running_until = false;
+						if (bfvm.stop_after != 0) {
+							// The interpreter finishes its batch first, so the
+							// pause is recorded once it says where it stopped
+							bfvm.paused_at = UINT64_MAX;
+							bfvm.stop_after = 0;
+							pause_pending = recording != NULL;
+						} else {
+							bfvm.stop_after = -1;
+							record_event(JOURNAL_RESUME, 0, NULL);
+						}
+						break;
+					case KEY_F(3):
+						// type program input
+						if (bfvm.input.type == INPUT_INTERACTIVE) {
+							LineEditor_open(&line_editor, "Input: ");
+						}
+						break;
+					case KEY_F(4):
+						// run until something happens
+						LineEditor_open(&line_editor, "Run until: ");
+						editing = EDIT_UNTIL;
+						break;
+					case KEY_NPAGE:
+						// scroll the memory pane
+						if (memview.start + memview.cells < bfvm.tape_size) memview.start += memview.cells;
+						break;
+					case KEY_PPAGE:
+						memview.start = (memview.start > memview.cells) ? memview.start - memview.cells : 0;
+						break;
+					case KEY_HOME:
+						memview.start = 0;
+						break;
+					case '\t':
+						// jump to the next non-zero cell past the memory pane
+						memview.query = Snapshot_query(&bfvm.snapshot, SNAPSHOT_QUERY_NEXT,
+							memview.start + memview.cells, 0);
+						break;
+					case KEY_BTAB:
+						// or the last one before it
+						memview.query = Snapshot_query(&bfvm.snapshot, SNAPSHOT_QUERY_PREV, memview.start, 0);
+						break;
+					case '/':
+						LineEditor_open(&line_editor, "Find value: ");
+						editing = EDIT_FIND;
 						break;
 					case KEY_CTRL('R'):
 						// reset the VM
-
-						// kill the interpreter thread
-						bfvm.die = true;
-						thrd_join(bfvm.interpreter_thread, NULL);
-
-						// reset the interpreter
-						reset_vm();
-
-						// start a new interpreter thread
-						thrd_create(&bfvm.interpreter_thread, interpreter_thread, NULL);
+						record_event(JOURNAL_RESET, 0, NULL);
+						restart_vm();
 
 						// notify the user that a reset has occured
 						flash();
@@ -263,11 +1050,11 @@ int main(int argc, char *argv[]) {
 					case ',':
 					case '[':
 					case ']':
-						// dispatch instruction to interpreter
+					case '#':
+						// dispatch instruction (or breakpoint) to interpreter
 						Queue_enqueue(&bfvm.instructionQueue, ch);
+						record_event(JOURNAL_BATCH, 1, &(char){ ch });
 					default:
-						// if in record mode record input
-						// enter key should insert a newline 
 						break;
 				}
 			}
@@ -280,9 +1067,42 @@ end_mainloop:
 		delete_pane(panes[i]);
 	}
 	endwin();
-	
+
+	// stop the interpreter so that nothing is left half-written
+	bfvm.die = true;
+	thrd_join(bfvm.interpreter_thread, NULL);
+
+cleanup:
+	// Keep the loops compiled this session for next time, as long as the
+	// program is still the one the cache is for
+	if (cache_keyed && bfvm.program_length == cache_length && Cache_compiled_loops(&bfvm) > cache_loops) {
+		Cache_save(&bfvm, &cache_key);
+	}
+
+	if (bfvm.input.error != 0) fprintf(stderr, "Unable to read the input: %s\n", strerror(bfvm.input.error));
+
+	// The last block has to be written while the program and tape are still
+	// there
+	if (bfvm.trace != NULL) {
+		trace_checkpoint();
+		Trace_close(bfvm.trace);
+		bfvm.trace = NULL;
+	}
+
 	free(bfvm.tape);
+	interpreter_unload(&bfvm);
+	InputSource_free(&bfvm.input);
+	Snapshot_free(&bfvm.snapshot);
+	Summary_free(&bfvm.summary);
 
-	return 0;
+	if (recording != NULL) {
+		record_pause();
+		Journal_close(recording);
+	}
+	if (replaying) Journal_close(&replay_journal);
+
+	if (stats_file != NULL) fclose(stats_file);
+
+	return status;
 }
 
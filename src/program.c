@@ -0,0 +1,224 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "program.h"
+
+// Longest loop body considered for idiom folding
+#define IDIOM_MAX_BODY	64
+
+/*
+ * Helper function which appends an op to a program
+ */
+static struct Op *_Program_emit(Program *p, uint32_t type, int64_t arg, uint32_t steps, size_t src) {
+	if (p->length == p->_capacity) {
+		size_t capacity = p->_capacity ? p->_capacity * 2 : 256;
+		struct Op *ops = realloc(p->ops, capacity * sizeof(struct Op));
+
+		if (ops == NULL) return NULL;
+
+		p->ops = ops;
+		p->_capacity = capacity;
+	}
+
+	struct Op *op = &p->ops[p->length++];
+	*op = (struct Op){ .type = type, .steps = steps, .arg = arg, .src = src };
+
+	return op;
+}
+
+/*
+ * Helper function which tries to replace the loop whose body is src[b..e)
+ * with a single idiom op. Returns 1 if it did, 0 if the loop isn't an idiom
+ * and -1 on failure.
+ */
+static int _Program_fold_idiom(Program *p, const char *src, size_t b, size_t e) {
+	const size_t len = e - b;
+	int64_t deltas[2 * IDIOM_MAX_BODY + 1] = { 0 };
+	int64_t offset = 0, min_offset = 0, max_offset = 0;
+	bool changes_cells = false;
+
+	if (len == 0 || len > IDIOM_MAX_BODY) return 0;
+
+	// Work out where the body moves to and what it adds to each cell
+	for (size_t i=b; i < e; ++i) {
+		switch (src[i]) {
+			case '+': ++deltas[IDIOM_MAX_BODY + offset]; changes_cells = true; break;
+			case '-': --deltas[IDIOM_MAX_BODY + offset]; changes_cells = true; break;
+			case '>': ++offset; break;
+			case '<': --offset; break;
+			default:
+				// I/O and nested loops can't be folded
+				return 0;
+		}
+
+		if (offset < min_offset) min_offset = offset;
+		if (offset > max_offset) max_offset = offset;
+	}
+
+	if (!changes_cells) {
+		// [>], [<<] etc.
+		if (offset == 0) return 0;  // an infinite loop; leave it be
+
+		return _Program_emit(p, OP_SCAN, offset, len, b-1) ? 1 : -1;
+	}
+
+	// Anything else has to come back to where it started and count the loop's
+	// own cell down (or up) by one
+	const int64_t counter = deltas[IDIOM_MAX_BODY];
+
+	if (offset != 0 || (counter != -1 && counter != 1)) return 0;
+
+	// Destinations which wrap onto the loop's own cell would change the count
+	if ((uint64_t)-min_offset >= p->tape_size || (uint64_t)max_offset >= p->tape_size) return 0;
+
+	size_t terms = 0;
+
+	for (int64_t o=min_offset; o <= max_offset; ++o) {
+		if (o != 0 && deltas[IDIOM_MAX_BODY + o] != 0) ++terms;
+	}
+
+	struct Op *op = _Program_emit(p, (terms == 0) ? OP_CLEAR : OP_MULADD, counter, len, b-1);
+	if (op == NULL) return -1;
+	op->target = terms;
+
+	for (int64_t o=min_offset; o <= max_offset; ++o) {
+		if (o == 0 || deltas[IDIOM_MAX_BODY + o] == 0) continue;
+
+		if ((op = _Program_emit(p, OP_TERM, deltas[IDIOM_MAX_BODY + o], 0, b-1)) == NULL) return -1;
+		op->offset = o;
+	}
+
+	return 1;
+}
+
+int Program_compile(Program *p, size_t n, const char *src, size_t tape_size, unsigned flags) {
+	char *code = malloc(n ? n : 1);
+	size_t *match = malloc((n ? n : 1) * sizeof(size_t));
+	size_t *stack = malloc((n ? n : 1) * sizeof(size_t));
+	size_t len = 0, depth = 0;
+
+	memset(p, 0, sizeof(Program));
+	p->tape_size = tape_size;
+	p->flags = flags;
+
+	if (code == NULL || match == NULL || stack == NULL) goto fail;
+
+	// Strip everything that isn't an instruction and match up the brackets
+	for (size_t i=0; i < n; ++i) {
+		switch (src[i]) {
+			case '[':
+				stack[depth++] = len;
+				match[len] = SIZE_MAX;
+				break;
+			case ']':
+				if (depth > 0) {
+					match[len] = stack[--depth];
+					match[match[len]] = len;
+				} else {
+					match[len] = SIZE_MAX;
+				}
+				break;
+			case '+': case '-': case '>': case '<': case '.': case ',':
+				break;
+			default:
+				continue;
+		}
+
+		code[len++] = src[i];
+	}
+
+	p->source_length = len;
+	depth = 0;
+
+	for (size_t i=0; i < len; ) {
+		const char c = code[i];
+		struct Op *op;
+		int folded;
+
+		switch (c) {
+			case '+':
+			case '-':
+			case '>':
+			case '<': {
+				// + and - fold together, as do > and <
+				const bool is_add = (c == '+' || c == '-');
+				int64_t amount = 0;
+				size_t j = i;
+
+				do {
+					amount += (code[j] == '+' || code[j] == '>') ? 1 : -1;
+					++j;
+				} while ((flags & PROGRAM_FOLD_RUNS) && j < len && j - i < UINT32_MAX
+					&& (is_add ? (code[j] == '+' || code[j] == '-') : (code[j] == '>' || code[j] == '<')));
+
+				if (_Program_emit(p, is_add ? OP_ADD : OP_MOVE, amount, j - i, i) == NULL) goto fail;
+
+				i = j;
+				continue;
+			}
+			case '.':
+				if (_Program_emit(p, OP_OUT, 0, 1, i) == NULL) goto fail;
+				break;
+			case ',':
+				if (_Program_emit(p, OP_IN, 0, 1, i) == NULL) goto fail;
+				break;
+			case '[':
+				if (match[i] == SIZE_MAX) {
+					if ((op = _Program_emit(p, OP_JZ, 0, 1, i)) == NULL) goto fail;
+					op->target = OP_UNMATCHED;
+					break;
+				}
+
+				if (flags & PROGRAM_FOLD_IDIOMS) {
+					if ((folded = _Program_fold_idiom(p, code, i+1, match[i])) == -1) goto fail;
+
+					if (folded) {
+						i = match[i] + 1;
+						continue;
+					}
+				}
+
+				if (_Program_emit(p, OP_JZ, 0, 1, i) == NULL) goto fail;
+				stack[depth++] = p->length - 1;
+				break;
+			case ']':
+				if (match[i] == SIZE_MAX) {
+					if (_Program_emit(p, OP_NOP, 0, 1, i) == NULL) goto fail;
+					break;
+				}
+
+				if ((op = _Program_emit(p, OP_JNZ, 0, 1, i)) == NULL) goto fail;
+
+				op->target = stack[--depth];
+				p->ops[op->target].target = p->length - 1;
+				break;
+		}
+
+		++i;
+	}
+
+	if (_Program_emit(p, OP_END, 0, 0, len) == NULL) goto fail;
+
+	free(code);
+	free(match);
+	free(stack);
+	return 0;
+
+fail:
+	free(code);
+	free(match);
+	free(stack);
+	Program_free(p);
+	errno = ENOMEM;
+	return -1;
+}
+
+void Program_free(Program *p) {
+	free(p->ops);
+
+	p->ops = NULL;
+	p->length = p->_capacity = 0;
+}
@@ -0,0 +1,605 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+
+// Most of a client's requests buffered at once, which is just enough for the
+// largest request there can be
+#define SERVER_MAX_IN	(SERVER_MAX_PAYLOAD + sizeof(struct ServerFrame))
+
+/*
+ * Helper function which reads the i'th number of a payload, which might not
+ * be aligned
+ */
+static inline uint64_t _Server_u64(const uint8_t *payload, size_t i) {
+	uint64_t v;
+	memcpy(&v, payload + i * sizeof(uint64_t), sizeof(uint64_t));
+	return v;
+}
+
+/*
+ * Helper function which disconnects a client, sending whatever it can of
+ * what's left for it first
+ */
+static void _Server_drop(struct ServerClient *c) {
+	if (c->out_length > 0) send(c->fd, c->out + c->out_start, c->out_length, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+	close(c->fd);
+	free(c->in);
+	free(c->out);
+
+	*c = (struct ServerClient){ .fd = -1 };
+}
+
+/*
+ * Helper function which queues a message for a client. Returns where to write
+ * its payload, or NULL if the client can't take any more, in which case it is
+ * marked to be disconnected.
+ */
+static uint8_t *_Server_frame(struct ServerClient *c, uint8_t type, uint32_t id, uint64_t length) {
+	const struct ServerFrame frame = { .type = type, .id = id, .length = length };
+	const size_t n = sizeof(struct ServerFrame) + length;
+
+	if (c->dead) return NULL;
+
+	if (c->out_length + n > SERVER_MAX_BACKLOG) goto fail;
+
+	// Move what's left to the front before growing
+	if (c->out_start + c->out_length + n > c->out_capacity && c->out_start > 0) {
+		memmove(c->out, c->out + c->out_start, c->out_length);
+		c->out_start = 0;
+	}
+
+	if (c->out_length + n > c->out_capacity) {
+		size_t capacity = c->out_capacity ? c->out_capacity : 65536;
+		while (capacity < c->out_length + n) capacity *= 2;
+
+		uint8_t *out = realloc(c->out, capacity);
+		if (out == NULL) goto fail;
+
+		c->out = out;
+		c->out_capacity = capacity;
+	}
+
+	uint8_t *p = c->out + c->out_start + c->out_length;
+	memcpy(p, &frame, sizeof(struct ServerFrame));
+	c->out_length += n;
+
+	return p + sizeof(struct ServerFrame);
+
+fail:
+	c->dead = true;
+	return NULL;
+}
+
+/*
+ * Helper function which replies to a request with a copy of n bytes of data
+ */
+static void _Server_reply(struct ServerClient *c, uint32_t id, size_t n, const void *data) {
+	uint8_t *p = _Server_frame(c, SERVER_REPLY, id, n);
+	if (p != NULL && n > 0) memcpy(p, data, n);
+}
+
+/*
+ * Helper function which tells a client a request failed with an errno value
+ */
+static void _Server_error(struct ServerClient *c, uint32_t id, int err) {
+	const char *message = strerror(err);
+	const size_t n = strlen(message);
+	uint8_t *p = _Server_frame(c, SERVER_ERROR, id, sizeof(uint64_t) + n);
+
+	if (p != NULL) {
+		const uint64_t code = err;
+		memcpy(p, &code, sizeof(uint64_t));
+		memcpy(p + sizeof(uint64_t), message, n);
+	}
+}
+
+/*
+ * Helper function which describes the VM
+ */
+static struct ServerState _Server_state(const Server *s, const struct BrainfuckVM *vm) {
+	return (struct ServerState){
+		.version = SERVER_VERSION,
+		.cell_size = vm->cell_size,
+		.tape_size = vm->tape_size,
+		.program_length = vm->program_length,
+		.ip = vm->ip,
+		.current_cell = vm->current_cell,
+		.steps = vm->steps,
+		.output_bytes = vm->output_bytes,
+		.status = vm->status,
+		.running = s->_running
+	};
+}
+
+/*
+ * Helper function which sends any output the VM has written since last time
+ * to every client
+ */
+static void _Server_output(Server *s, const struct BrainfuckVM *vm) {
+	const uint64_t total = vm->output_bytes;
+
+	if (total == s->_output_sent) return;
+
+	// Anything which has been overwritten on the output tape is lost
+	const uint64_t n = total - s->_output_sent;
+	const uint64_t kept = (n < vm->output.length) ? n : vm->output.length;
+	const uint64_t lost = n - kept;
+
+	for (size_t i=0; i < SERVER_MAX_CLIENTS; ++i) {
+		uint8_t *p;
+
+		if (s->_clients[i].fd < 0) continue;
+		if ((p = _Server_frame(&s->_clients[i], SERVER_OUTPUT, 0, sizeof(uint64_t) + kept)) == NULL) continue;
+
+		memcpy(p, &lost, sizeof(uint64_t));
+		StringCassette_tail(&vm->output, kept, (char *)p + sizeof(uint64_t));
+	}
+
+	s->_output_sent = total;
+}
+
+/*
+ * Helper function which ends a run and tells every client where it stopped
+ */
+static void _Server_stop(Server *s, struct BrainfuckVM *vm) {
+	s->_running = false;
+	vm->until = UNTIL_NONE;
+
+	const struct ServerState state = _Server_state(s, vm);
+
+	for (size_t i=0; i < SERVER_MAX_CLIENTS; ++i) {
+		if (s->_clients[i].fd < 0) continue;
+
+		uint8_t *p = _Server_frame(&s->_clients[i], SERVER_STOPPED, s->_run_id, sizeof(state));
+		if (p != NULL) memcpy(p, &state, sizeof(state));
+	}
+}
+
+/*
+ * Helper function which starts a run
+ */
+static int _Server_run(Server *s, struct BrainfuckVM *vm, uint32_t id, uint64_t length, const uint8_t *payload) {
+	if (s->_running) return EBUSY;
+	if (length != 0 && length != sizeof(uint64_t) && length != 4 * sizeof(uint64_t)) return EINVAL;
+
+	const uint64_t limit = (length > 0) ? _Server_u64(payload, 0) : 0;
+
+	if (length > sizeof(uint64_t)) {
+		const uint64_t until = _Server_u64(payload, 1);
+		const uint64_t cell = _Server_u64(payload, 2);
+		const uint64_t value = _Server_u64(payload, 3);
+
+		if (until > UNTIL_INPUT || cell >= vm->tape_size || value > VM_CELL_MASK(vm)) return EINVAL;
+
+		// The cell and value have to be set before the interpreter sees this
+		vm->until_cell = cell;
+		vm->until_value = value;
+		atomic_store_explicit(&vm->until, (int)until, memory_order_release);
+	}
+
+	s->_running = true;
+	s->_run_id = id;
+	s->_run_left = (limit == 0) ? UINT64_MAX : limit;
+
+	return 0;
+}
+
+/*
+ * Helper function which replies with the cells in a list of ranges
+ */
+static int _Server_read(struct ServerClient *c, const struct BrainfuckVM *vm, uint32_t id,
+						uint64_t length, const uint8_t *payload) {
+	const size_t ranges = length / (2 * sizeof(uint64_t));
+	uint64_t cells = 0;
+
+	if (length % (2 * sizeof(uint64_t)) != 0) return EINVAL;
+
+	for (size_t i=0; i < ranges; ++i) {
+		const uint64_t start = _Server_u64(payload, 2*i), count = _Server_u64(payload, 2*i + 1);
+
+		if (start > vm->tape_size || count > vm->tape_size - start) return ERANGE;
+		if (count > SERVER_MAX_PAYLOAD / vm->cell_size - cells) return E2BIG;
+
+		cells += count;
+	}
+
+	uint8_t *p = _Server_frame(c, SERVER_REPLY, id, cells * vm->cell_size);
+	if (p == NULL) return 0;
+
+	// Cells are already stored the way the protocol sends them
+	for (size_t i=0; i < ranges; ++i) {
+		const uint64_t start = _Server_u64(payload, 2*i), count = _Server_u64(payload, 2*i + 1);
+
+		memcpy(p, vm->tape + start * vm->cell_size, count * vm->cell_size);
+		p += count * vm->cell_size;
+	}
+
+	return 0;
+}
+
+/*
+ * Helper function which handles a request. Returns 0 if it has been replied
+ * to, or an errno value to reply with.
+ */
+static int _Server_handle(Server *s, struct ServerClient *c, struct BrainfuckVM *vm,
+						  const struct ServerFrame *frame, const uint8_t *payload) {
+	struct ServerState state;
+	uint64_t n;
+	uint8_t *p;
+
+	switch (frame->type) {
+		case SERVER_STATE:
+			break;
+		case SERVER_LOAD:
+			if (s->_running) return EBUSY;
+
+			// The reset comes first so that a trace's last block is
+			// recorded against the old program
+			if (frame->flags & SERVER_LOAD_REPLACE) {
+				interpreter_reset(vm);
+				interpreter_unload(vm);
+				s->_output_sent = 0;
+			}
+
+			if (interpreter_load(vm, frame->length, (const char *)payload) != 0) return errno;
+			break;
+		case SERVER_RESET:
+			if (s->_running) return EBUSY;
+
+			interpreter_reset(vm);
+			s->_output_sent = 0;
+			break;
+		case SERVER_RUN:
+			if ((n = _Server_run(s, vm, frame->id, frame->length, payload)) != 0) return n;
+
+			_Server_reply(c, frame->id, 0, NULL);
+			return 0;
+		case SERVER_STEP:
+			if (s->_running) return EBUSY;
+			if (frame->length != 0 && frame->length != sizeof(uint64_t)) return EINVAL;
+
+			n = (frame->length > 0) ? _Server_u64(payload, 0) : 1;
+
+			// Nothing else is answered until these have run; long runs
+			// should use SERVER_RUN
+			interpreter_run(vm, n);
+			_Server_output(s, vm);
+			break;
+		case SERVER_PAUSE:
+			if (s->_running) _Server_stop(s, vm);
+			break;
+		case SERVER_BREAK:
+			if (frame->length % sizeof(uint64_t) != 0) return EINVAL;
+
+			for (size_t i=0; i < frame->length / sizeof(uint64_t); ++i) {
+				n = _Server_u64(payload, i);
+
+				if (n >= vm->program_length) return EINVAL;
+				interpreter_set_break(vm, n, !(frame->flags & SERVER_BREAK_CLEAR));
+			}
+
+			n = vm->_break_count;
+			_Server_reply(c, frame->id, sizeof(uint64_t), &n);
+			return 0;
+		case SERVER_BREAKS:
+			if ((p = _Server_frame(c, SERVER_REPLY, frame->id, vm->_break_count * sizeof(uint64_t))) == NULL) {
+				return 0;
+			}
+
+			for (size_t i=0; i < vm->program_length && vm->_break_count > 0; ++i) {
+				if (!vm->_breaks[i]) continue;
+
+				n = i;
+				memcpy(p, &n, sizeof(uint64_t));
+				p += sizeof(uint64_t);
+			}
+
+			return 0;
+		case SERVER_READ:
+			return _Server_read(c, vm, frame->id, frame->length, payload);
+		case SERVER_INPUT:
+			if (frame->length > 0 && InputSource_push(&vm->input, frame->length, (const char *)payload) != 0) {
+				return errno;
+			}
+
+			if (frame->flags & SERVER_INPUT_EOF) InputSource_close(&vm->input);
+
+			_Server_reply(c, frame->id, 0, NULL);
+			return 0;
+		case SERVER_QUIT:
+			s->_quit = true;
+			_Server_reply(c, frame->id, 0, NULL);
+			return 0;
+		default:
+			return ENOSYS;
+	}
+
+	// Everything else replies with the state of the VM
+	state = _Server_state(s, vm);
+	_Server_reply(c, frame->id, sizeof(state), &state);
+
+	return 0;
+}
+
+/*
+ * Helper function which reads what a client has sent and handles every whole
+ * request in it
+ */
+static void _Server_receive(Server *s, struct ServerClient *c, struct BrainfuckVM *vm) {
+	// A client streaming requests can't make the buffer grow without bound;
+	// once it's full, the rest is read after what's here has been handled
+	while (c->in_length < SERVER_MAX_IN) {
+		if (c->in_capacity == c->in_length) {
+			size_t capacity = (c->in_capacity > 0) ? c->in_capacity * 2 : 65536;
+			if (capacity > SERVER_MAX_IN) capacity = SERVER_MAX_IN;
+
+			uint8_t *in = realloc(c->in, capacity);
+
+			if (in == NULL) {
+				c->dead = true;
+				return;
+			}
+
+			c->in = in;
+			c->in_capacity = capacity;
+		}
+
+		const ssize_t received = recv(c->fd, c->in + c->in_length, c->in_capacity - c->in_length, MSG_DONTWAIT);
+
+		if (received > 0) {
+			c->in_length += received;
+			continue;
+		}
+
+		if (received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) c->dead = true;
+		break;
+	}
+
+	size_t used = 0;
+	struct ServerFrame frame;
+
+	while (!c->dead && c->in_length - used >= sizeof(struct ServerFrame)) {
+		memcpy(&frame, c->in + used, sizeof(struct ServerFrame));
+
+		if (frame.length > SERVER_MAX_PAYLOAD) {
+			// There's no way to find the next request after this
+			_Server_error(c, frame.id, E2BIG);
+			c->dead = true;
+			break;
+		}
+
+		if (c->in_length - used - sizeof(struct ServerFrame) < frame.length) break;
+
+		const int err = _Server_handle(s, c, vm, &frame, c->in + used + sizeof(struct ServerFrame));
+		if (err != 0) _Server_error(c, frame.id, err);
+
+		used += sizeof(struct ServerFrame) + frame.length;
+	}
+
+	memmove(c->in, c->in + used, c->in_length - used);
+	c->in_length -= used;
+
+	// Don't hang on to the buffer a big program was loaded through
+	if (c->in_length == 0 && c->in_capacity > 65536) {
+		free(c->in);
+		c->in = NULL;
+		c->in_capacity = 0;
+	}
+}
+
+/*
+ * Helper function which sends as much of what's waiting for a client as it
+ * will take
+ */
+static void _Server_flush(struct ServerClient *c) {
+	while (c->out_length > 0) {
+		const ssize_t sent = send(c->fd, c->out + c->out_start, c->out_length, MSG_NOSIGNAL | MSG_DONTWAIT);
+
+		if (sent < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) c->dead = true;
+			return;
+		}
+
+		c->out_start += sent;
+		c->out_length -= sent;
+	}
+
+	c->out_start = 0;
+}
+
+/*
+ * Helper function which accepts a new client
+ */
+static void _Server_accept(Server *s) {
+	const int fd = accept(s->_listen, NULL, NULL);
+
+	if (fd < 0) return;
+
+	for (size_t i=0; i < SERVER_MAX_CLIENTS; ++i) {
+		if (s->_clients[i].fd >= 0) continue;
+
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+		s->_clients[i] = (struct ServerClient){ .fd = fd };
+		return;
+	}
+
+	// No room
+	close(fd);
+}
+
+int Server_open(Server *s, const char *path) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+	int err;
+
+	memset(s, 0, sizeof(Server));
+	s->_listen = -1;
+	s->_wake[0] = s->_wake[1] = -1;
+
+	for (size_t i=0; i < SERVER_MAX_CLIENTS; ++i) {
+		s->_clients[i].fd = -1;
+	}
+
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	// Only ever replace a socket; anything else at path is left alone
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) unlink(path);
+
+	if ((s->_path = strdup(path)) == NULL) return -1;
+
+	if ((s->_listen = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) goto fail;
+	if (bind(s->_listen, (struct sockaddr *)&addr, sizeof(addr)) != 0) goto fail;
+
+	if (listen(s->_listen, SERVER_MAX_CLIENTS) != 0) {
+		err = errno;
+		unlink(path);
+		errno = err;
+		goto fail;
+	}
+
+	fcntl(s->_listen, F_SETFL, fcntl(s->_listen, F_GETFL) | O_NONBLOCK);
+
+	if (pipe(s->_wake) != 0) {
+		err = errno;
+		unlink(path);
+		errno = err;
+		goto fail;
+	}
+
+	for (int i=0; i < 2; ++i) {
+		fcntl(s->_wake[i], F_SETFL, fcntl(s->_wake[i], F_GETFL) | O_NONBLOCK);
+	}
+
+	return 0;
+
+fail:
+	err = errno;
+
+	if (s->_listen >= 0) close(s->_listen);
+
+	free(s->_path);
+	s->_path = NULL;
+	s->_listen = -1;
+	s->_wake[0] = s->_wake[1] = -1;
+
+	errno = err;
+	return -1;
+}
+
+int Server_run(Server *s, struct BrainfuckVM *vm) {
+	struct pollfd fds[SERVER_MAX_CLIENTS + 2];
+
+	while (!s->_quit && !vm->die) {
+		if (s->_running) {
+			const size_t n = (s->_run_left < SERVER_RUN_BATCH) ? s->_run_left : SERVER_RUN_BATCH;
+			const size_t executed = interpreter_run(vm, n);
+
+			if (s->_run_left != UINT64_MAX) s->_run_left -= executed;
+
+			_Server_output(s, vm);
+
+			// Breakpoints, input, the end of the program and whatever the run
+			// was until all end it
+			if (vm->status != INTERPRETER_OK || s->_run_left == 0) _Server_stop(s, vm);
+		}
+
+		// Send what's ready while the VM is running, rather than waiting for
+		// the socket to be writable
+		size_t count = 2;
+		fds[0] = (struct pollfd){ .fd = s->_listen, .events = POLLIN };
+		fds[1] = (struct pollfd){ .fd = s->_wake[0], .events = POLLIN };
+
+		for (size_t i=0; i < SERVER_MAX_CLIENTS; ++i) {
+			struct ServerClient *c = &s->_clients[i];
+
+			if (c->fd < 0) continue;
+
+			_Server_flush(c);
+
+			if (c->dead) {
+				_Server_drop(c);
+				continue;
+			}
+
+			fds[count++] = (struct pollfd){ .fd = c->fd, .events = POLLIN | (c->out_length > 0 ? POLLOUT : 0) };
+		}
+
+		// A signal which came after vm->die was checked still wakes the
+		// server up, through the pipe
+		if (poll(fds, count, s->_running ? 0 : -1) < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		if (fds[0].revents & POLLIN) _Server_accept(s);
+
+		if (fds[1].revents & POLLIN) {
+			char drain[64];
+			while (read(s->_wake[0], drain, sizeof(drain)) > 0);
+		}
+
+		for (size_t i=2; i < count; ++i) {
+			struct ServerClient *c = NULL;
+
+			for (size_t j=0; j < SERVER_MAX_CLIENTS && c == NULL; ++j) {
+				if (s->_clients[j].fd == fds[i].fd) c = &s->_clients[j];
+			}
+
+			if (c == NULL) continue;
+
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR)) _Server_receive(s, c, vm);
+			if (fds[i].revents & POLLOUT) _Server_flush(c);
+		}
+	}
+
+	// Get the replies to the last requests out
+	for (size_t i=0; i < SERVER_MAX_CLIENTS; ++i) {
+		if (s->_clients[i].fd >= 0) _Server_flush(&s->_clients[i]);
+	}
+
+	return 0;
+}
+
+void Server_close(Server *s) {
+	for (size_t i=0; i < SERVER_MAX_CLIENTS; ++i) {
+		if (s->_clients[i].fd >= 0) _Server_drop(&s->_clients[i]);
+	}
+
+	if (s->_listen >= 0) {
+		close(s->_listen);
+		unlink(s->_path);
+	}
+
+	if (s->_wake[0] >= 0) {
+		close(s->_wake[0]);
+		close(s->_wake[1]);
+	}
+
+	free(s->_path);
+	s->_path = NULL;
+	s->_listen = -1;
+	s->_wake[0] = s->_wake[1] = -1;
+}
+
+void Server_wake(Server *s) {
+	const int err = errno;
+
+	if (s->_wake[1] >= 0) write(s->_wake[1], "", 1);
+
+	errno = err;
+}
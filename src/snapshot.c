@@ -0,0 +1,72 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+int Snapshot_init(Snapshot *s, size_t cell_size, size_t max_cells) {
+	memset(s, 0, sizeof(Snapshot));
+
+	for (size_t i=0; i < 3; ++i) {
+		s->_frames[i].window = malloc(max_cells * cell_size);
+		s->_frames[i].output = malloc(SNAPSHOT_OUTPUT_TAIL);
+
+		if (s->_frames[i].window == NULL || s->_frames[i].output == NULL) {
+			Snapshot_free(s);
+			return -1;
+		}
+	}
+
+	s->_front = 0;
+	s->_middle = 1;
+	s->_back = 2;
+	s->_max_cells = max_cells;
+
+	return 0;
+}
+
+void Snapshot_free(Snapshot *s) {
+	for (size_t i=0; i < 3; ++i) {
+		free(s->_frames[i].window);
+		free(s->_frames[i].output);
+
+		s->_frames[i].window = NULL;
+		s->_frames[i].output = NULL;
+	}
+}
+
+void Snapshot_request(Snapshot *s, size_t start, size_t cells, size_t minimap) {
+	if (cells > s->_max_cells) cells = s->_max_cells;
+	if (minimap > SNAPSHOT_MINIMAP_MAX) minimap = SNAPSHOT_MINIMAP_MAX;
+
+	atomic_store_explicit(&s->_window_start, start, memory_order_relaxed);
+	atomic_store_explicit(&s->_window_cells, cells, memory_order_relaxed);
+	atomic_store_explicit(&s->_minimap_length, minimap, memory_order_relaxed);
+}
+
+unsigned Snapshot_query(Snapshot *s, enum SnapshotQuery type, size_t from, uintmax_t value) {
+	atomic_store_explicit(&s->_query_type, type, memory_order_relaxed);
+	atomic_store_explicit(&s->_query_from, from, memory_order_relaxed);
+	atomic_store_explicit(&s->_query_value, value, memory_order_relaxed);
+
+	// The number goes last. If the interpreter reads a half-written search,
+	// it answers under the old number, which the UI has stopped waiting for.
+	const unsigned query = atomic_load_explicit(&s->_query, memory_order_relaxed) + 1;
+	atomic_store_explicit(&s->_query, query, memory_order_release);
+
+	return query;
+}
+
+void Snapshot_commit(Snapshot *s) {
+	// Release makes the frame's contents visible to the UI along with it
+	unsigned old = atomic_exchange_explicit(&s->_middle, s->_back | SNAPSHOT_FRESH, memory_order_acq_rel);
+	s->_back = old & ~SNAPSHOT_FRESH;
+}
+
+const struct SnapshotFrame *Snapshot_read(Snapshot *s) {
+	if (atomic_load_explicit(&s->_middle, memory_order_relaxed) & SNAPSHOT_FRESH) {
+		unsigned old = atomic_exchange_explicit(&s->_middle, s->_front, memory_order_acq_rel);
+		s->_front = old & ~SNAPSHOT_FRESH;
+	}
+
+	return &s->_frames[s->_front];
+}
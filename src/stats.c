@@ -0,0 +1,70 @@
+#include <stdio.h>
+#include <time.h>
+
+#include "stats.h"
+
+uint64_t Stats_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void Stats_sample(struct Stats *s, struct BrainfuckVM *vm, Pane **panes, uint64_t frame_budget) {
+	const uint64_t now = Stats_now();
+	const uint64_t steps = vm->steps;
+	const uint64_t output_bytes = vm->output_bytes;
+	const uint64_t idle_time = vm->idle_time;
+
+	// A reset sets the VM's counters back to zero, so count from there
+	const uint64_t prev_steps = (steps >= s->steps) ? s->steps : 0;
+	const uint64_t prev_output = (output_bytes >= s->output_bytes) ? s->output_bytes : 0;
+	const uint64_t prev_idle = (idle_time >= s->_idle_time) ? s->_idle_time : 0;
+
+	if (s->time != 0 && now > s->time) {
+		const double elapsed = (now - s->time) / 1e6;
+
+		s->steps_per_sec = (steps - prev_steps) / elapsed;
+		s->output_per_sec = (output_bytes - prev_output) / elapsed;
+		s->idle = (idle_time - prev_idle) / 1e9 / elapsed;
+
+		if (s->idle > 1.0) s->idle = 1.0;
+	}
+
+	s->time = now;
+	s->steps = steps;
+	s->queue_depth = vm->instructionQueue.length;
+	s->output_bytes = output_bytes;
+	s->_idle_time = idle_time;
+
+	s->frame_time = 0;
+	s->frame_budget = frame_budget;
+	s->pane_count = 0;
+
+	for (size_t i=0; panes[i] != NULL && i < STATS_MAX_PANES; ++i) {
+		s->pane_titles[i] = panes[i]->title;
+		s->pane_render_times[i] = panes[i]->render_time;
+		s->frame_time += panes[i]->render_time;
+		++s->pane_count;
+	}
+}
+
+void Stats_write_json(const struct Stats *s, FILE *fp) {
+	fprintf(fp, "{\"time_us\":%llu,\"steps\":%llu,\"steps_per_sec\":%.1f,"
+			"\"queue_depth\":%zu,\"output_bytes\":%llu,\"output_per_sec\":%.1f,"
+			"\"interpreter_idle\":%.4f,\"frame_us\":%llu,\"frame_budget_us\":%llu,"
+			"\"pane_render_us\":{",
+			(unsigned long long)s->time, (unsigned long long)s->steps, s->steps_per_sec,
+			s->queue_depth, (unsigned long long)s->output_bytes, s->output_per_sec,
+			s->idle, (unsigned long long)s->frame_time, (unsigned long long)s->frame_budget);
+
+	for (size_t i=0; i < s->pane_count; ++i) {
+		// pane titles are plain words, so they don't need escaping
+		fprintf(fp, "%s\"%s\":%llu", (i > 0) ? "," : "",
+				s->pane_titles[i] ? s->pane_titles[i] : "",
+				(unsigned long long)s->pane_render_times[i]);
+	}
+
+	fprintf(fp, "}}\n");
+	fflush(fp);
+}
@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "interpreter.h"
+#include "summary.h"
+
+/*
+ * What a search is looking for: either any non-zero cell, or a given value
+ */
+struct Match {
+	bool nonzero;
+	uintmax_t value;
+};
+
+/*
+ * Helper function which returns one past the last cell of a block
+ */
+static size_t _Summary_block_end(const Summary *s, size_t b) {
+	const size_t end = (b + 1) << SUMMARY_BLOCK_SHIFT;
+	return (end < s->tape_size) ? end : s->tape_size;
+}
+
+/*
+ * Helper function which returns the number of tape cells under a node. The
+ * last block may be short, and leaves past the last block have no cells.
+ */
+static uint64_t _Summary_node_cells(const Summary *s, size_t node) {
+	size_t span = 1;
+
+	// Walk down the left edge to find the node's first leaf
+	while (node < s->_leaves) {
+		node <<= 1;
+		span <<= 1;
+	}
+
+	const size_t lo = (node - s->_leaves) << SUMMARY_BLOCK_SHIFT;
+	size_t hi = (node - s->_leaves + span) << SUMMARY_BLOCK_SHIFT;
+	if (hi > s->tape_size) hi = s->tape_size;
+
+	return (lo < hi) ? hi - lo : 0;
+}
+
+/*
+ * Helper function which checks whether anything under a node could match
+ */
+static bool _Summary_may_match(const Summary *s, size_t node, const struct Match *m) {
+	if (m->nonzero) return s->_count[node] > 0;
+	if (m->value != 0) return s->_max[node] >= m->value;
+
+	// Looking for a zero; there must be fewer non-zero cells than cells
+	return s->_count[node] < _Summary_node_cells(s, node);
+}
+
+static inline bool _matches(uintmax_t v, const struct Match *m) {
+	return m->nonzero ? v != 0 : v == m->value;
+}
+
+/*
+ * Helper function which returns the first block at or after b which could
+ * match, or SIZE_MAX
+ */
+static size_t _Summary_first_block(const Summary *s, size_t b, const struct Match *m) {
+	if (b >= s->blocks) return SIZE_MAX;
+
+	size_t node = s->_leaves + b;
+
+	if (!_Summary_may_match(s, node, m)) {
+		// Climb until a right sibling could match, then take the leftmost
+		// path down from it
+		for (;;) {
+			if (node <= 1) return SIZE_MAX;
+
+			if ((node & 1) == 0 && _Summary_may_match(s, node + 1, m)) {
+				++node;
+				break;
+			}
+
+			node >>= 1;
+		}
+
+		while (node < s->_leaves) {
+			node = _Summary_may_match(s, 2 * node, m) ? 2 * node : 2 * node + 1;
+		}
+	}
+
+	b = node - s->_leaves;
+	return (b < s->blocks) ? b : SIZE_MAX;
+}
+
+/*
+ * Helper function which returns the last block at or before b which could
+ * match, or SIZE_MAX
+ */
+static size_t _Summary_last_block(const Summary *s, size_t b, const struct Match *m) {
+	size_t node = s->_leaves + b;
+
+	if (!_Summary_may_match(s, node, m)) {
+		for (;;) {
+			if (node <= 1) return SIZE_MAX;
+
+			if ((node & 1) == 1 && _Summary_may_match(s, node - 1, m)) {
+				--node;
+				break;
+			}
+
+			node >>= 1;
+		}
+
+		while (node < s->_leaves) {
+			node = _Summary_may_match(s, 2 * node + 1, m) ? 2 * node + 1 : 2 * node;
+		}
+	}
+
+	return node - s->_leaves;
+}
+
+/*
+ * Helper function which searches cells [lo, hi) of the tape forwards
+ */
+static size_t _Summary_scan(const Summary *s, const uint8_t *tape, size_t lo, size_t hi, const struct Match *m) {
+	for (size_t i=lo; i < hi; ++i) {
+		if (_matches(load_cell(tape + i * s->cell_size, s->cell_size), m)) return i;
+	}
+
+	return SIZE_MAX;
+}
+
+/*
+ * Helper function which searches cells [lo, hi) of the tape backwards
+ */
+static size_t _Summary_scan_back(const Summary *s, const uint8_t *tape, size_t lo, size_t hi, const struct Match *m) {
+	for (size_t i=hi; i > lo; --i) {
+		if (_matches(load_cell(tape + (i-1) * s->cell_size, s->cell_size), m)) return i-1;
+	}
+
+	return SIZE_MAX;
+}
+
+/*
+ * Helper function which finds the first matching cell at or after from
+ */
+static size_t _Summary_search(const Summary *s, const uint8_t *tape, size_t from, const struct Match *m) {
+	if (from >= s->tape_size) return SIZE_MAX;
+
+	// The summary doesn't say where in a block the matches are, so the rest
+	// of the first block is searched directly
+	size_t b = from >> SUMMARY_BLOCK_SHIFT;
+	size_t found = _Summary_scan(s, tape, from, _Summary_block_end(s, b), m);
+
+	// A block which could match might not (e.g. its largest value is bigger
+	// than the one being searched for), in which case carry on after it
+	while (found == SIZE_MAX && (b = _Summary_first_block(s, b + 1, m)) != SIZE_MAX) {
+		found = _Summary_scan(s, tape, b << SUMMARY_BLOCK_SHIFT, _Summary_block_end(s, b), m);
+	}
+
+	return found;
+}
+
+int Summary_init(Summary *s, size_t tape_size, size_t cell_size) {
+	memset(s, 0, sizeof(Summary));
+
+	s->tape_size = tape_size;
+	s->cell_size = cell_size;
+	s->blocks = (tape_size + SUMMARY_BLOCK_CELLS - 1) >> SUMMARY_BLOCK_SHIFT;
+
+	s->_leaves = 1;
+	while (s->_leaves < s->blocks) s->_leaves <<= 1;
+
+	s->_count = calloc(2 * s->_leaves, sizeof(uint64_t));
+	s->_max = calloc(2 * s->_leaves, sizeof(uintmax_t));
+	s->_dirty = calloc(s->blocks, sizeof(bool));
+	s->_dirty_list = malloc(s->blocks * sizeof(size_t));
+
+	if (s->_count == NULL || s->_max == NULL || s->_dirty == NULL || s->_dirty_list == NULL) {
+		Summary_free(s);
+		return -1;
+	}
+
+	return 0;
+}
+
+void Summary_free(Summary *s) {
+	free(s->_count);
+	free(s->_max);
+	free(s->_dirty);
+	free(s->_dirty_list);
+
+	s->_count = NULL;
+	s->_max = NULL;
+	s->_dirty = NULL;
+	s->_dirty_list = NULL;
+}
+
+void Summary_clear(Summary *s) {
+	memset(s->_count, 0, 2 * s->_leaves * sizeof(uint64_t));
+	memset(s->_max, 0, 2 * s->_leaves * sizeof(uintmax_t));
+	memset(s->_dirty, 0, s->blocks * sizeof(bool));
+	s->_dirty_length = 0;
+}
+
+void Summary_refresh(Summary *s, const uint8_t *tape, size_t max_blocks) {
+	for (; max_blocks > 0 && s->_dirty_length > 0; --max_blocks) {
+		const size_t b = s->_dirty_list[--s->_dirty_length];
+		uint64_t count = 0;
+		uintmax_t max = 0;
+
+		s->_dirty[b] = false;
+
+		for (size_t i=b << SUMMARY_BLOCK_SHIFT; i < _Summary_block_end(s, b); ++i) {
+			const uintmax_t v = load_cell(tape + i * s->cell_size, s->cell_size);
+
+			count += (v != 0);
+			if (v > max) max = v;
+		}
+
+		// Update the block's leaf and everything above it
+		size_t node = s->_leaves + b;
+		s->_count[node] = count;
+		s->_max[node] = max;
+
+		for (node >>= 1; node >= 1; node >>= 1) {
+			s->_count[node] = s->_count[2 * node] + s->_count[2 * node + 1];
+			s->_max[node] = (s->_max[2 * node] > s->_max[2 * node + 1]) ? s->_max[2 * node] : s->_max[2 * node + 1];
+		}
+	}
+}
+
+uint64_t Summary_count(const Summary *s, size_t lo, size_t hi, uint64_t *cells) {
+	if (hi > s->tape_size) hi = s->tape_size;
+
+	if (lo >= hi) {
+		*cells = 0;
+		return 0;
+	}
+
+	size_t l = lo >> SUMMARY_BLOCK_SHIFT;
+	size_t r = ((hi - 1) >> SUMMARY_BLOCK_SHIFT) + 1;
+	uint64_t count = 0;
+
+	*cells = _Summary_block_end(s, r - 1) - (l << SUMMARY_BLOCK_SHIFT);
+
+	// Sum the nodes which exactly cover blocks [l, r)
+	for (l += s->_leaves, r += s->_leaves; l < r; l >>= 1, r >>= 1) {
+		if (l & 1) count += s->_count[l++];
+		if (r & 1) count += s->_count[--r];
+	}
+
+	return count;
+}
+
+size_t Summary_next_nonzero(const Summary *s, const uint8_t *tape, size_t from) {
+	const struct Match m = { .nonzero = true };
+	return _Summary_search(s, tape, from, &m);
+}
+
+size_t Summary_prev_nonzero(const Summary *s, const uint8_t *tape, size_t from) {
+	const struct Match m = { .nonzero = true };
+
+	if (from > s->tape_size) from = s->tape_size;
+	if (from == 0) return SIZE_MAX;
+
+	size_t b = (from - 1) >> SUMMARY_BLOCK_SHIFT;
+	size_t found = _Summary_scan_back(s, tape, b << SUMMARY_BLOCK_SHIFT, from, &m);
+
+	while (found == SIZE_MAX && b > 0 && (b = _Summary_last_block(s, b - 1, &m)) != SIZE_MAX) {
+		found = _Summary_scan_back(s, tape, b << SUMMARY_BLOCK_SHIFT, _Summary_block_end(s, b), &m);
+	}
+
+	return found;
+}
+
+size_t Summary_find(const Summary *s, const uint8_t *tape, size_t from, uintmax_t value) {
+	const struct Match m = { .nonzero = false, .value = value };
+	return _Summary_search(s, tape, from, &m);
+}
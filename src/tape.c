@@ -0,0 +1,322 @@
+#include <string.h>
+
+#include "tape.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TAPE_X86
+#endif
+
+// Scans with strides wider than this many bytes hardly ever have two
+// candidates in the same vector, so they are done one cell at a time
+#define SCAN_MAX_VECTOR_STRIDE	16
+
+/*
+ * Kernels for one instruction set
+ *
+ * forward		Returns the first zero cell out of from, from+stride, ... which
+ * 				is below end, or SIZE_MAX
+ * backward		Returns the first zero cell out of from, from-stride, ...
+ * 				which is at least lo, or SIZE_MAX
+ * compare		See tape_compare
+ */
+struct TapeKernels {
+	const char *name;
+	size_t (*forward)(const uint8_t *tape, size_t w, size_t from, size_t end, size_t stride);
+	size_t (*backward)(const uint8_t *tape, size_t w, size_t from, size_t lo, size_t stride);
+	size_t (*compare)(const uint8_t *a, const uint8_t *b, size_t n);
+};
+
+/*
+ * Helper function which checks whether the w byte cell at p is zero
+ */
+static inline bool _is_zero(const uint8_t *p, size_t w) {
+	switch (w) {
+		case 1: return *p == 0;
+		case 2: { uint16_t v; memcpy(&v, p, 2); return v == 0; }
+		case 4: { uint32_t v; memcpy(&v, p, 4); return v == 0; }
+		case 8: { uint64_t v; memcpy(&v, p, 8); return v == 0; }
+		default:
+			for (size_t i=0; i < w; ++i) {
+				if (p[i] != 0) return false;
+			}
+
+			return true;
+	}
+}
+
+static size_t _forward_scalar(const uint8_t *tape, size_t w, size_t from, size_t end, size_t stride) {
+	for (size_t i=from; i < end; i += stride) {
+		if (_is_zero(tape + i * w, w)) return i;
+	}
+
+	return SIZE_MAX;
+}
+
+static size_t _backward_scalar(const uint8_t *tape, size_t w, size_t from, size_t lo, size_t stride) {
+	for (size_t i=from; i >= lo; i -= stride) {
+		if (_is_zero(tape + i * w, w)) return i;
+		if (i - lo < stride) break;
+	}
+
+	return SIZE_MAX;
+}
+
+static size_t _compare_scalar(const uint8_t *a, const uint8_t *b, size_t n) {
+	size_t i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		uint64_t x, y;
+		memcpy(&x, a + i, 8);
+		memcpy(&y, b + i, 8);
+
+		if (x != y) break;
+	}
+
+	while (i < n && a[i] == b[i]) ++i;
+
+	return i;
+}
+
+static const struct TapeKernels _scalar = {
+	.name = "scalar",
+	.forward = _forward_scalar,
+	.backward = _backward_scalar,
+	.compare = _compare_scalar
+};
+
+static const struct TapeKernels *_kernels = &_scalar;
+
+#ifdef TAPE_X86
+
+/*
+ * Defines the vector kernels for one instruction set. ZERO_MASK(p, w) loads
+ * CHUNK bytes from p and returns a bit mask with bit i set if a zero w byte
+ * cell starts i bytes in. Candidates are filtered down to the cells which
+ * fall on the stride afterwards, so cells that are never visited can be zero
+ * without slowing the scan down.
+ */
+#define DEFINE_KERNELS(ISA, CHUNK, ZERO_MASK, DIFF_MASK) \
+	__attribute__((target(#ISA))) \
+	static size_t _forward_##ISA(const uint8_t *tape, size_t w, size_t from, size_t end, size_t stride) { \
+		if (stride * w > SCAN_MAX_VECTOR_STRIDE || (w & (w - 1)) != 0) { \
+			return _forward_scalar(tape, w, from, end, stride); \
+		} \
+		\
+		const size_t per = (CHUNK) / w; \
+		size_t i = from; \
+		\
+		for (; end - i >= per; i += per) { \
+			uint32_t m = ZERO_MASK(tape + i * w, w); \
+			\
+			for (; m != 0; m &= m - 1) { \
+				const size_t cell = i + __builtin_ctz(m) / w; \
+				if ((cell - from) % stride == 0) return cell; \
+			} \
+		} \
+		\
+		/* the remaining cells don't fill a whole vector */ \
+		i += (stride - (i - from) % stride) % stride; \
+		return _forward_scalar(tape, w, i, end, stride); \
+	} \
+	\
+	__attribute__((target(#ISA))) \
+	static size_t _backward_##ISA(const uint8_t *tape, size_t w, size_t from, size_t lo, size_t stride) { \
+		if (stride * w > SCAN_MAX_VECTOR_STRIDE || (w & (w - 1)) != 0) { \
+			return _backward_scalar(tape, w, from, lo, stride); \
+		} \
+		\
+		const size_t per = (CHUNK) / w; \
+		size_t i = from + 1; \
+		\
+		for (; i - lo >= per; i -= per) { \
+			const size_t base = i - per; \
+			uint32_t m = ZERO_MASK(tape + base * w, w); \
+			\
+			while (m != 0) { \
+				const unsigned bit = 31 - __builtin_clz(m); \
+				const size_t cell = base + bit / w; \
+				if ((from - cell) % stride == 0) return cell; \
+				m &= ~(UINT32_C(1) << bit); \
+			} \
+		} \
+		\
+		if (i == lo) return SIZE_MAX; \
+		\
+		/* the last candidate below i */ \
+		const size_t skip = (from - (i - 1) + stride - 1) / stride * stride; \
+		if (from - lo < skip) return SIZE_MAX; \
+		return _backward_scalar(tape, w, from - skip, lo, stride); \
+	} \
+	\
+	__attribute__((target(#ISA))) \
+	static size_t _compare_##ISA(const uint8_t *a, const uint8_t *b, size_t n) { \
+		size_t i = 0; \
+		\
+		for (; i + (CHUNK) <= n; i += (CHUNK)) { \
+			const uint32_t m = DIFF_MASK(a + i, b + i); \
+			if (m != 0) return i + __builtin_ctz(m); \
+		} \
+		\
+		return i + _compare_scalar(a + i, b + i, n - i); \
+	} \
+	\
+	static const struct TapeKernels _##ISA = { \
+		.name = #ISA, \
+		.forward = _forward_##ISA, \
+		.backward = _backward_##ISA, \
+		.compare = _compare_##ISA \
+	};
+
+__attribute__((target("sse2")))
+static inline uint32_t _zero_mask_sse2(const uint8_t *p, size_t w) {
+	const __m128i v = _mm_loadu_si128((const __m128i *)p);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i eq;
+
+	// Only the bit for the first byte of each cell is kept
+	switch (w) {
+		case 1:
+			return _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+		case 2:
+			return _mm_movemask_epi8(_mm_cmpeq_epi16(v, zero)) & 0x5555;
+		case 4:
+			return _mm_movemask_epi8(_mm_cmpeq_epi32(v, zero)) & 0x1111;
+		default:
+			// SSE2 has no 64 bit compare, so both halves have to be zero
+			eq = _mm_cmpeq_epi32(v, zero);
+			eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+			return _mm_movemask_epi8(eq) & 0x0101;
+	}
+}
+
+__attribute__((target("sse2")))
+static inline uint32_t _diff_mask_sse2(const uint8_t *a, const uint8_t *b) {
+	const __m128i x = _mm_loadu_si128((const __m128i *)a);
+	const __m128i y = _mm_loadu_si128((const __m128i *)b);
+
+	return ~_mm_movemask_epi8(_mm_cmpeq_epi8(x, y)) & 0xFFFF;
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t _zero_mask_avx2(const uint8_t *p, size_t w) {
+	const __m256i v = _mm256_loadu_si256((const __m256i *)p);
+	const __m256i zero = _mm256_setzero_si256();
+
+	switch (w) {
+		case 1: return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero));
+		case 2: return _mm256_movemask_epi8(_mm256_cmpeq_epi16(v, zero)) & 0x55555555;
+		case 4: return _mm256_movemask_epi8(_mm256_cmpeq_epi32(v, zero)) & 0x11111111;
+		default: return _mm256_movemask_epi8(_mm256_cmpeq_epi64(v, zero)) & 0x01010101;
+	}
+}
+
+__attribute__((target("avx2")))
+static inline uint32_t _diff_mask_avx2(const uint8_t *a, const uint8_t *b) {
+	const __m256i x = _mm256_loadu_si256((const __m256i *)a);
+	const __m256i y = _mm256_loadu_si256((const __m256i *)b);
+
+	return ~(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+}
+
+DEFINE_KERNELS(sse2, 16, _zero_mask_sse2, _diff_mask_sse2)
+DEFINE_KERNELS(avx2, 32, _zero_mask_avx2, _diff_mask_avx2)
+
+#undef DEFINE_KERNELS
+
+/*
+ * Picks the best kernels the CPU supports before main runs
+ */
+__attribute__((constructor))
+static void _select_kernels(void) {
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")) {
+		_kernels = &_avx2;
+	} else if (__builtin_cpu_supports("sse2")) {
+		_kernels = &_sse2;
+	}
+}
+
+#endif  // TAPE_X86
+
+bool tape_scan(const uint8_t *tape, size_t tape_size, size_t cell_size,
+			   size_t *cell, ssize_t stride, uint64_t *iterations) {
+	const uint64_t max = *iterations;
+	const bool backward = stride < 0;
+	const size_t start = *cell;
+
+	// Only the stride's distance around the tape matters
+	const size_t s = (backward ? (size_t)0 - (size_t)stride : (size_t)stride) % tape_size;
+
+	*iterations = 0;
+
+	if (max == 0 || s == 0) return false;
+
+	// pos is the first cell of the current pass over the tape, and k is the
+	// number of strides taken to reach it
+	size_t pos = backward
+		? ((start >= s) ? start - s : start + tape_size - s)
+		: ((start < tape_size - s) ? start + s : start + s - tape_size);
+	uint64_t k = 1;
+
+	// Each pass after the first starts less than s cells from the end it
+	// entered from, so if s + 1 passes haven't found a zero the scan is
+	// going round in circles
+	for (size_t pass=0; pass <= s; ++pass) {
+		// The number of candidates left in this pass, within the limit
+		uint64_t left = (backward ? pos : tape_size - 1 - pos) / s + 1;
+		bool limited = false;
+
+		if (left >= max - k + 1) {
+			left = max - k + 1;
+			limited = true;
+		}
+
+		const size_t span = (left - 1) * s;
+		const size_t found = backward
+			? _kernels->backward(tape, cell_size, pos, pos - span, s)
+			: _kernels->forward(tape, cell_size, pos, pos + span + 1, s);
+
+		if (found != SIZE_MAX) {
+			*cell = found;
+			*iterations = k + (backward ? pos - found : found - pos) / s;
+			return true;
+		}
+
+		const size_t last = backward ? pos - span : pos + span;
+
+		if (limited) {
+			*cell = last;
+			*iterations = max;
+			return false;
+		}
+
+		// Wrap around onto the other end of the tape
+		k += left;
+		pos = backward ? last + tape_size - s : last + s - tape_size;
+	}
+
+	// There are no zero cells on this stride at all, so skip straight to
+	// where the limit runs out
+	const size_t moved = (unsigned __int128)(max % tape_size) * s % tape_size;
+
+	*cell = backward
+		? ((start >= moved) ? start - moved : start + tape_size - moved)
+		: ((start < tape_size - moved) ? start + moved : start + moved - tape_size);
+	*iterations = max;
+	return false;
+}
+
+size_t tape_compare(const uint8_t *a, const uint8_t *b, size_t n) {
+	return _kernels->compare(a, b, n);
+}
+
+void tape_clear(uint8_t *tape, size_t n) {
+	// The C library already picks a vectorised memset for this CPU
+	memset(tape, 0, n);
+}
+
+const char *tape_kernel(void) {
+	return _kernels->name;
+}
@@ -0,0 +1,142 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tier.h"
+
+/*
+ * Helper function which frees a list of jobs along with their programs
+ */
+static void _Tier_drop(TierJob *job) {
+	while (job != NULL) {
+		TierJob *next = job->_next;
+
+		if (job->result == 0) Program_free(&job->program);
+		Tier_free_job(job);
+
+		job = next;
+	}
+}
+
+/*
+ * The compiler thread. Compiles jobs in the order they were requested.
+ */
+static int _Tier_thread(void *arg) {
+	Tier *t = arg;
+
+	mtx_lock(&t->_lock);
+
+	for (;;) {
+		while (t->_pending == NULL && !t->_die) cnd_wait(&t->_cond, &t->_lock);
+
+		if (t->_die) break;
+
+		// Pop the oldest job
+		TierJob **last = &t->_pending;
+		while ((*last)->_next != NULL) last = &(*last)->_next;
+
+		TierJob *job = *last;
+		*last = NULL;
+
+		// Compile without holding the lock, so that more jobs can be queued
+		mtx_unlock(&t->_lock);
+
+		job->result = Program_compile(&job->program, job->length, job->src,
+			job->program.tape_size, TIER_FLAGS);
+
+		mtx_lock(&t->_lock);
+
+		job->_next = t->_done;
+		t->_done = job;
+		atomic_store_explicit(&t->_ready, true, memory_order_release);
+	}
+
+	mtx_unlock(&t->_lock);
+	return 0;
+}
+
+int Tier_request(Tier *t, size_t open, size_t n, const char *src, size_t tape_size) {
+	TierJob *job = calloc(1, sizeof(TierJob));
+
+	if (job == NULL) return -1;
+
+	if ((job->src = malloc(n)) == NULL) {
+		free(job);
+		return -1;
+	}
+
+	memcpy(job->src, src, n);
+	job->open = open;
+	job->length = n;
+	job->program.tape_size = tape_size;
+
+	if (!t->_started) {
+		if (mtx_init(&t->_lock, mtx_plain) != thrd_success) goto fail;
+
+		if (cnd_init(&t->_cond) != thrd_success) {
+			mtx_destroy(&t->_lock);
+			goto fail;
+		}
+
+		t->_die = false;
+		t->_pending = t->_done = NULL;
+
+		if (thrd_create(&t->_thread, _Tier_thread, t) != thrd_success) {
+			cnd_destroy(&t->_cond);
+			mtx_destroy(&t->_lock);
+			goto fail;
+		}
+
+		t->_started = true;
+	}
+
+	mtx_lock(&t->_lock);
+	job->_next = t->_pending;
+	t->_pending = job;
+	cnd_signal(&t->_cond);
+	mtx_unlock(&t->_lock);
+
+	return 0;
+
+fail:
+	Tier_free_job(job);
+	errno = EAGAIN;
+	return -1;
+}
+
+TierJob *Tier_collect(Tier *t) {
+	if (!t->_started || !Tier_ready(t)) return NULL;
+
+	mtx_lock(&t->_lock);
+	TierJob *done = t->_done;
+	t->_done = NULL;
+	atomic_store_explicit(&t->_ready, false, memory_order_relaxed);
+	mtx_unlock(&t->_lock);
+
+	return done;
+}
+
+void Tier_free_job(TierJob *job) {
+	free(job->src);
+	free(job);
+}
+
+void Tier_stop(Tier *t) {
+	if (!t->_started) return;
+
+	mtx_lock(&t->_lock);
+	t->_die = true;
+	cnd_signal(&t->_cond);
+	mtx_unlock(&t->_lock);
+
+	thrd_join(t->_thread, NULL);
+
+	_Tier_drop(t->_pending);
+	_Tier_drop(t->_done);
+	t->_pending = t->_done = NULL;
+	atomic_store_explicit(&t->_ready, false, memory_order_relaxed);
+
+	cnd_destroy(&t->_cond);
+	mtx_destroy(&t->_lock);
+	t->_started = false;
+}
@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+int Trace_create(Trace *t, const char *path, size_t cell_size, size_t tape_size) {
+	struct TraceHeader hdr = {
+		.magic = TRACE_MAGIC,
+		.version = TRACE_VERSION,
+		.cell_size = cell_size,
+		.tape_size = tape_size
+	};
+
+	t->_length = 0;
+	t->_records = malloc(TRACE_BUFFER_RECORDS * sizeof(struct TraceRecord));
+
+	if (t->_records == NULL) return -1;
+
+	if ((t->_fp = fopen(path, "wb")) == NULL) {
+		free(t->_records);
+		return -1;
+	}
+
+	fwrite(&hdr, sizeof(hdr), 1, t->_fp);
+
+	return ferror(t->_fp) ? -1 : 0;
+}
+
+void Trace_close(Trace *t) {
+	Trace_flush(t);
+	fclose(t->_fp);
+	free(t->_records);
+}
+
+void Trace_flush(Trace *t) {
+	if (t->_length == 0) return;
+
+	// The whole buffer goes out as one chunk
+	struct TraceChunk chunk = { .type = TRACE_CHUNK_BLOCKS, .count = t->_length };
+
+	fwrite(&chunk, sizeof(chunk), 1, t->_fp);
+	fwrite(t->_records, sizeof(struct TraceRecord), t->_length, t->_fp);
+
+	t->_length = 0;
+}
+
+void Trace_program(Trace *t, size_t n, const char *program) {
+	// Records before this point can only refer to the program so far, so
+	// they have to be written first
+	Trace_flush(t);
+
+	for (size_t i=0; i < n; ) {
+		struct TraceChunk chunk = { .type = TRACE_CHUNK_PROGRAM };
+		chunk.count = (n - i > UINT32_MAX) ? UINT32_MAX : n - i;
+
+		fwrite(&chunk, sizeof(chunk), 1, t->_fp);
+		fwrite(program + i, 1, chunk.count, t->_fp);
+
+		i += chunk.count;
+	}
+}
+
+void Trace_reset(Trace *t) {
+	struct TraceChunk chunk = { .type = TRACE_CHUNK_RESET, .count = 0 };
+
+	Trace_flush(t);
+	fwrite(&chunk, sizeof(chunk), 1, t->_fp);
+}
+
+void Trace_unload(Trace *t) {
+	struct TraceChunk chunk = { .type = TRACE_CHUNK_UNLOAD, .count = 0 };
+
+	// Records before this point refer to the old program
+	Trace_flush(t);
+	fwrite(&chunk, sizeof(chunk), 1, t->_fp);
+}
@@ -1,8 +1,10 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "interpreter.h"
+#include "stats.h"
 #include "ui.h"
 
 Pane *create_pane(uint32_t id, int h, int w, int y, int x, char *title, PaneRendererCb *renderer) {
@@ -17,13 +19,14 @@ Pane *create_pane(uint32_t id, int h, int w, int y, int x, char *title, PaneRend
 	pane->h = h;
 
 	if (title != NULL) {
-		pane->title = malloc(strlen(title));
+		pane->title = malloc(strlen(title) + 1);
 		strcpy(pane->title, title);
 	} else {
 		pane->title = NULL;
 	}
 
 	pane->renderer = renderer;
+	pane->render_time = 0;
 
 	return pane;
 }
@@ -35,6 +38,9 @@ void delete_pane(Pane *pane) {
 }
 
 void render_pane(Pane *pane) {
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	// Call pane renderer
 	if (pane->renderer != NULL) {
 		pane->renderer(pane);
@@ -50,71 +56,204 @@ void render_pane(Pane *pane) {
 	}
 
 	wrefresh(pane->window);
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	pane->render_time = (end.tv_sec - start.tv_sec) * 1000000
+		+ (end.tv_nsec - start.tv_nsec) / 1000;
+}
+
+void LineEditor_open(LineEditor *ed, const char *prompt) {
+	ed->active = true;
+	ed->prompt = prompt;
+	ed->buffer[0] = '\0';
+	ed->length = 0;
+}
+
+int LineEditor_handle_key(LineEditor *ed, int ch) {
+	switch (ch) {
+		case '\n':
+		case '\r':
+		case KEY_ENTER:
+			return LINE_EDITOR_SUBMIT;
+		case 27:  // ESC
+			ed->active = false;
+			return LINE_EDITOR_CANCEL;
+		case KEY_CTRL('D'):
+			if (ed->length == 0) return LINE_EDITOR_EOF;
+			break;
+		case KEY_BACKSPACE:
+		case 127:
+		case '\b':
+			if (ed->length > 0) ed->buffer[--ed->length] = '\0';
+			break;
+		default:
+			// ignore function keys and anything that wont fit
+			if (ch >= 0 && ch <= 0xFF && ed->length < LINE_EDITOR_SIZE-1) {
+				ed->buffer[ed->length++] = ch;
+				ed->buffer[ed->length] = '\0';
+			}
+			break;
+	}
+
+	return LINE_EDITOR_CONTINUE;
+}
+
+void LineEditor_render(LineEditor *ed, WINDOW *win, int y) {
+	wmove(win, y, 0);
+	wclrtoeol(win);
+
+	if (ed->active) {
+		wprintw(win, "%s%s", ed->prompt, ed->buffer);
+	}
+
+	wrefresh(win);
 }
 
 
 /* Specific pane renderers */
 void MemPaneRenderer(Pane *pane) {
-	const uintmax_t cell_mask = ~(~((uintmax_t)0) << (bfvm.cell_size * 8));
-	const size_t current_cell = bfvm.current_cell;  // obtain this once so it doesnt get changed by another thread
 	const size_t cell_str_len = bfvm.cell_size * 2;  // length of the string representing the cell
+	const int map_width = pane->w - 2;
 
-	int x = 1, y = 1;
+	// Ask for as many cells as fit inside the border, leaving the bottom row
+	// for the minimap
+	memview.columns = (pane->w - 1) / (cell_str_len + 1);
+	if (memview.columns == 0) memview.columns = 1;
 
-	for (size_t i=0; i < bfvm.tape_size; ++i) {
-		// Obtain cell value
-		uintmax_t cell = *((uintmax_t *)(bfvm.tape + (i * bfvm.cell_size))) & cell_mask;
+	memview.cells = memview.columns * (pane->h - 3);
 
-		if (i == current_cell) wattron(pane->window, A_REVERSE);
+	Snapshot_request(&bfvm.snapshot, memview.start, memview.cells, map_width);
 
-		mvwprintw(pane->window, y, x, "%0*zX", (int)cell_str_len, cell);
-		
-		if (i == current_cell) wattroff(pane->window, A_REVERSE);
+	// Render whatever the interpreter last published, so that the tape can't
+	// change halfway through
+	const struct SnapshotFrame *frame = Snapshot_read(&bfvm.snapshot);
 
-		x += cell_str_len + 1;
+	werase(pane->window);
 
-		if (x > pane->w) {
-			x = 1;
-			++y;
-		}
+	if (!frame->valid) return;
+
+	// Jump to the result of a search once it comes in
+	if (memview.query != 0 && frame->query == memview.query) {
+		if (frame->query_result != SIZE_MAX)
+			memview.start = frame->query_result - frame->query_result % memview.columns;
+		else
+			flash();
+
+		memview.query = 0;
+	}
+
+	for (size_t i=0; i < frame->window_cells; ++i) {
+		const size_t index = frame->window_start + i;
+		const uintmax_t cell = load_cell(frame->window + i * bfvm.cell_size, bfvm.cell_size);
+		const int y = 1 + i / memview.columns;
+		const int x = 1 + (i % memview.columns) * (cell_str_len + 1);
+
+		if (index == frame->current_cell) wattron(pane->window, A_REVERSE);
+
+		mvwprintw(pane->window, y, x, "%0*jX", (int)cell_str_len, cell);
+
+		if (index == frame->current_cell) wattroff(pane->window, A_REVERSE);
+	}
+
+	// Minimap of the whole tape, darker where more cells are non-zero. The
+	// part of the tape on screen is highlighted.
+	static const char shades[] = " .:-=+*#%@";
+
+	for (size_t i=0; i < frame->minimap_length && i < (size_t)map_width; ++i) {
+		const size_t lo = i * bfvm.tape_size / frame->minimap_length;
+		const size_t hi = (i + 1) * bfvm.tape_size / frame->minimap_length;
+		const bool visible = hi > frame->window_start && lo < frame->window_start + frame->window_cells;
+		const bool pointer = frame->current_cell >= lo && frame->current_cell < hi;
+		const uint8_t level = frame->minimap[i];
+
+		char ch = shades[(level == 0) ? 0 : 1 + level * (sizeof(shades) - 3) / 255];
+		if (pointer) ch = '^';
+
+		if (visible) wattron(pane->window, A_REVERSE);
+		mvwaddch(pane->window, pane->h - 2, 1 + i, ch);
+		if (visible) wattroff(pane->window, A_REVERSE);
 	}
 }
 
 void OutPaneRenderer(Pane *pane) {
-	const size_t bufsize = (bfvm.output.length < 4096) ? bfvm.output.length : 4096;
-	char buffer[bufsize];
+	const struct SnapshotFrame *frame = Snapshot_read(&bfvm.snapshot);
 
-	wclear(pane->window);
+	werase(pane->window);
 	wmove(pane->window, 1, 1);
 
-	for (size_t i=StringCassette_getHead(&bfvm.output), b=0; b < bfvm.output.length; b += bufsize) {
-		i = StringCassette_read(&bfvm.output, bufsize, buffer, i);
-		//memcpy(buffer, bfvm.output._data, bufsize);
-
-		for (size_t j=0; j < bufsize; ++j) {
-			if (buffer[j] == '\0') {
-				continue;
-			} else if (buffer[j] == '\n') {
-				int x, y;
-				getyx(pane->window, y, x);
-				wmove(pane->window, y+1, 1);
-			} else {
-				int x, y;
-				getyx(pane->window, y, x);
-
-				if (x == pane->w-1) {
-					wmove(pane->window, ++y, 1);
-				}
-
-				if (y == pane->h-1) {
-					scroll(pane->window);
-					wmove(pane->window, y-1, 1);
-					wclrtoeol(pane->window);
-				}
-
-				waddch(pane->window, buffer[j]);
+	if (!frame->valid) return;
+
+	for (size_t j=0; j < frame->output_length; ++j) {
+		const char ch = frame->output[j];
+		int x, y;
+
+		if (ch == '\0') {
+			continue;
+		} else if (ch == '\n') {
+			getyx(pane->window, y, x);
+			wmove(pane->window, y+1, 1);
+		} else {
+			getyx(pane->window, y, x);
+
+			if (x == pane->w-1) {
+				wmove(pane->window, ++y, 1);
 			}
+
+			if (y == pane->h-1) {
+				scroll(pane->window);
+				wmove(pane->window, y-1, 1);
+				wclrtoeol(pane->window);
+			}
+
+			waddch(pane->window, ch);
 		}
 	}
 }
 
+
+/*
+ * Helper function which formats a number with an SI suffix
+ */
+static void _format_si(char *buf, size_t n, double val) {
+	static const char suffixes[] = " kMGTPE";
+	size_t i = 0;
+
+	while (val >= 1000.0 && i < sizeof(suffixes) - 2) {
+		val /= 1000.0;
+		++i;
+	}
+
+	if (i == 0)
+		snprintf(buf, n, "%.0f", val);
+	else
+		snprintf(buf, n, "%.2f%c", val, suffixes[i]);
+}
+
+void StatsPaneRenderer(Pane *pane) {
+	char a[32], b[32];
+	int y = 1;
+
+	werase(pane->window);
+
+	_format_si(a, sizeof(a), stats.steps);
+	_format_si(b, sizeof(b), stats.steps_per_sec);
+	mvwprintw(pane->window, y++, 2, "Steps    %s (%s/s)", a, b);
+
+	_format_si(a, sizeof(a), stats.queue_depth);
+	mvwprintw(pane->window, y++, 2, "Queue    %s", a);
+
+	_format_si(a, sizeof(a), stats.output_bytes);
+	_format_si(b, sizeof(b), stats.output_per_sec);
+	mvwprintw(pane->window, y++, 2, "Output   %sB (%sB/s)", a, b);
+
+	mvwprintw(pane->window, y++, 2, "Idle     %.1f%%", stats.idle * 100.0);
+
+	mvwprintw(pane->window, y++, 2, "Frame    %.1fms / %.1fms",
+			  stats.frame_time / 1000.0, stats.frame_budget / 1000.0);
+
+	for (size_t i=0; i < stats.pane_count && y < pane->h - 1; ++i) {
+		mvwprintw(pane->window, y++, 4, "%-8.8s %.1fms",
+				  stats.pane_titles[i] ? stats.pane_titles[i] : "?",
+				  stats.pane_render_times[i] / 1000.0);
+	}
+}
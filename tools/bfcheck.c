@@ -0,0 +1,943 @@
+/*
+ * bfcheck - checks bfdbg's execution engines against each other
+ *
+ * Every program is run on a straightforward reference interpreter, and then
+ * on each of bfdbg's engines, once for every cell size from 1 to 8. The final
+ * tape, pointer and output have to match the reference exactly, as does the
+ * step count for the engines which keep one. How long each engine took is
+ * recorded too, so that an optimisation can show it is faster as well as
+ * correct.
+ *
+ * Programs come from the files given on the command line and from a fuzzer,
+ * which generates random programs from a small grammar that leans towards the
+ * loop idioms the optimiser folds. Fuzzed programs run on small tapes, so
+ * that wrapping around the ends gets exercised too.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "codegen.h"
+#include "interpreter.h"
+#include "program.h"
+#include "tape.h"
+#include "tier.h"
+
+extern char **environ;
+
+// The most output compared from each run
+#define OUTPUT_MAX	65536
+
+// How long a compiled program may run before it is killed, in seconds
+#define RUN_TIMEOUT	10
+
+/*
+ * The engines checked against the reference
+ *
+ * ENGINE_INTERPRETER	interpreter_run, compiling hot loops in the background
+ * 						as it normally does
+ * ENGINE_TIERED		interpreter_run with every loop compiled up front, so
+ * 						that the op form runs wherever it can
+ * ENGINE_C				Ops without any folding, translated to C
+ * ENGINE_C_RUNS		Ops with runs folded, translated to C
+ * ENGINE_C_OPTIMISED	Ops with runs and idioms folded, translated to C
+ */
+enum Engine {
+	ENGINE_INTERPRETER,
+	ENGINE_TIERED,
+	ENGINE_C,
+	ENGINE_C_RUNS,
+	ENGINE_C_OPTIMISED,
+	ENGINE_COUNT
+};
+
+static const char *engine_names[] = { "interpreter", "tiered", "c", "c-runs", "c-optimised" };
+static const char *eof_names[] = { "keep", "0", "-1" };
+
+/*
+ * A program to run, with everything it runs with
+ *
+ * name			Where the program came from
+ * program		The instructions, without comments or breakpoints
+ * jumps		For each bracket, the index of its partner, or SIZE_MAX
+ */
+struct Case {
+	const char *name;
+
+	char *program;
+	size_t length;
+	size_t *jumps;
+
+	const char *input;
+	size_t input_length;
+
+	size_t tape_size;
+	size_t cell_size;
+	enum EOFBehaviour eof;
+};
+
+/*
+ * What a run left behind
+ *
+ * finished		Whether the program ran to its end
+ * steps		The number of instructions executed, or UINT64_MAX if the
+ * 				engine doesn't count them
+ * output		The last OUTPUT_MAX bytes of output
+ * output_bytes	The number of bytes output
+ * time			How long the run took, in seconds
+ */
+struct Result {
+	bool finished;
+	uint64_t steps;
+	size_t pointer;
+	uint64_t *tape;
+
+	char output[OUTPUT_MAX];
+	uint64_t output_bytes;
+
+	double time;
+};
+
+/*
+ * The totals for an engine
+ *
+ * runs			The number of runs compared with the reference
+ * mismatches	How many of them didn't match it
+ * time			The time those runs took
+ * reference	The time the reference took for the same runs
+ */
+struct Totals {
+	uint64_t runs;
+	uint64_t mismatches;
+	double time;
+	double reference;
+};
+
+/*
+ * Options
+ */
+struct Options {
+	uint64_t budget;  // the most steps a program may take
+	size_t tape_size;  // for programs from files
+	enum EOFBehaviour eof;  // for programs from files
+	const char *input;
+	size_t input_length;
+	bool compiled;  // whether to check the C engines
+	bool verbose;
+};
+
+static struct Totals totals[ENGINE_COUNT];
+static struct Totals reference_totals;
+static char *scratch;  // directory for the C engines' files
+
+void print_help(char *prgname) {
+	printf("Usage: %s [-hvx] [-e MODE] [-i FILE] [-m SIZE] [-n COUNT] [-r SEED] [-s STEPS] [FILE...]\n\n", prgname);
+
+	printf("Runs each FILE, then COUNT randomly generated programs, through a reference\n"
+		   "interpreter and each of bfdbg's execution engines with every cell size from\n"
+		   "1 to 8, and checks that they end with the same tape, pointer and output.\n"
+		   "Then prints how often each engine disagreed and how much faster than the\n"
+		   "reference it was. Exits with status 1 if any of them disagreed.\n\n");
+
+	printf("The C engines are timed from starting the process to it exiting, so\n"
+		   "short programs mostly measure process start up.\n\n");
+
+	printf("Options:\n");
+	printf("  -e MODE \tWhat , does at EOF in FILEs: 'keep', '0' or '-1'.\n"
+		   "          \tDefault is keep. Generated programs use all three.\n");
+	printf("  -h      \tDisplay this help message.\n");
+	printf("  -i FILE \tThe input for FILEs. Default is none.\n");
+	printf("  -m SIZE \tThe tape length for FILEs. Default is 1024.\n");
+	printf("  -n COUNT\tThe number of programs to generate. Default is 20.\n");
+	printf("  -r SEED \tThe seed for generating programs. Default is the time.\n");
+	printf("  -s STEPS\tThe most instructions a program may execute. Programs\n"
+		   "          \twhich don't finish in time are skipped. Default is\n"
+		   "          \t10000000.\n");
+	printf("  -v      \tPrint each program's times.\n");
+	printf("  -x      \tDon't check the C engines, which need a C compiler ($CC).\n");
+	printf("\nThe C engines' files are kept in a directory under $TMPDIR (or /tmp).\n");
+}
+
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Strips everything but the eight instructions from source, and matches its
+ * brackets the same way the interpreter does
+ */
+static int make_case(struct Case *c, const char *name, size_t n, const char *src) {
+	size_t *open = malloc((n + 1) * sizeof(size_t));
+	size_t open_length = 0;
+
+	c->name = name;
+	c->program = malloc(n + 1);
+	c->jumps = malloc((n + 1) * sizeof(size_t));
+	c->length = 0;
+
+	if (open == NULL || c->program == NULL || c->jumps == NULL) {
+		free(open);
+		return -1;
+	}
+
+	for (size_t i=0; i < n; ++i) {
+		const size_t here = c->length;
+
+		switch (src[i]) {
+			case '[':
+				open[open_length++] = here;
+				c->jumps[here] = SIZE_MAX;
+				break;
+			case ']':
+				if (open_length > 0) {
+					c->jumps[here] = open[--open_length];
+					c->jumps[c->jumps[here]] = here;
+				} else {
+					c->jumps[here] = SIZE_MAX;
+				}
+				break;
+			case '+': case '-': case '>': case '<': case '.': case ',':
+				break;
+			default:
+				continue;
+		}
+
+		c->program[c->length++] = src[i];
+	}
+
+	free(open);
+	return 0;
+}
+
+static void free_case(struct Case *c) {
+	free(c->program);
+	free(c->jumps);
+}
+
+/*
+ * Adds a block of fewer than OUTPUT_MAX bytes to the output kept, dropping
+ * the oldest bytes to make room
+ */
+static void keep_block(struct Result *r, size_t n, const char *data) {
+	const size_t kept = (r->output_bytes + n < OUTPUT_MAX) ? r->output_bytes : OUTPUT_MAX - n;
+
+	memmove(r->output, r->output + ((r->output_bytes < OUTPUT_MAX) ? r->output_bytes : OUTPUT_MAX) - kept, kept);
+	memcpy(r->output + kept, data, n);
+
+	r->output_bytes += n;
+}
+
+/*
+ * Keeps the last OUTPUT_MAX bytes of output, in order
+ */
+static void keep_output(struct Result *r, size_t n, const char *data) {
+	if (n < OUTPUT_MAX) {
+		keep_block(r, n, data);
+		return;
+	}
+
+	memcpy(r->output, data + n - OUTPUT_MAX, OUTPUT_MAX);
+	r->output_bytes += n;
+}
+
+/*
+ * The reference interpreter. It executes one instruction at a time, exactly
+ * as the interpreter thread is meant to behave.
+ */
+static void run_reference(const struct Case *c, uint64_t budget, struct Result *r) {
+	const uint64_t mask = (c->cell_size >= 8) ? UINT64_MAX : (UINT64_C(1) << (c->cell_size * 8)) - 1;
+	uint64_t *tape = r->tape;
+	size_t ip = 0, cell = 0, in = 0;
+	uint64_t steps = 0;
+
+	// Output is kept a block at a time
+	char out[4096];
+	size_t out_length = 0;
+
+	const double start = now();
+
+	while (ip < c->length && steps < budget) {
+		switch (c->program[ip]) {
+			case '+':
+				tape[cell] = (tape[cell] + 1) & mask;
+				break;
+			case '-':
+				tape[cell] = (tape[cell] - 1) & mask;
+				break;
+			case '>':
+				cell = (cell + 1 == c->tape_size) ? 0 : cell + 1;
+				break;
+			case '<':
+				cell = (cell == 0) ? c->tape_size - 1 : cell - 1;
+				break;
+			case '.':
+				out[out_length++] = tape[cell] & 0xFF;
+
+				if (out_length == sizeof(out)) {
+					keep_block(r, out_length, out);
+					out_length = 0;
+				}
+				break;
+			case ',':
+				if (in < c->input_length)
+					tape[cell] = (uint8_t)c->input[in++];
+				else if (c->eof == EOF_ZERO)
+					tape[cell] = 0;
+				else if (c->eof == EOF_NEGATIVE)
+					tape[cell] = mask;
+				break;
+			case '[':
+				if (tape[cell] == 0) {
+					// A [ without a ] waits for it forever
+					if (c->jumps[ip] == SIZE_MAX) goto end;
+
+					ip = c->jumps[ip];
+				}
+				break;
+			case ']':
+				if (tape[cell] != 0 && c->jumps[ip] != SIZE_MAX) ip = c->jumps[ip];
+				break;
+		}
+
+		++ip;
+		++steps;
+	}
+
+end:
+	r->time = now() - start;
+	keep_block(r, out_length, out);
+
+	r->finished = ip >= c->length || (c->program[ip] == '[' && c->jumps[ip] == SIZE_MAX && tape[cell] == 0);
+	r->steps = steps;
+	r->pointer = cell;
+}
+
+/*
+ * Compiles every loop in a VM's program to ops, the same way the tier would
+ * once they got hot
+ */
+static void compile_loops(struct BrainfuckVM *vm) {
+	for (size_t open=0; open < vm->program_length; ++open) {
+		if (vm->program[open] != '[' || vm->_jumps[open] == SIZE_MAX) continue;
+
+		Program *p = malloc(sizeof(Program));
+
+		if (p == NULL || Program_compile(p, vm->_jumps[open] - open + 1, vm->program + open,
+										 vm->tape_size, TIER_FLAGS) != 0) {
+			free(p);
+			continue;
+		}
+
+		vm->_compiled[open] = p;
+	}
+}
+
+/*
+ * Runs a program on bfdbg's interpreter
+ */
+static int run_vm(const struct Case *c, uint64_t budget, bool tiered, struct Result *r) {
+	struct BrainfuckVM vm = {
+		.cell_size = c->cell_size,
+		.tape_size = c->tape_size,
+		.output_tape_size = OUTPUT_MAX,
+		.stop_after = -1,
+		.step_limit = UINT64_MAX,
+		.eof_behaviour = c->eof
+	};
+	int result = -1;
+
+	StringCassette_init(&vm.output, OUTPUT_MAX);
+	Queue_init(&vm.instructionQueue);
+	InputSource_init_interactive(&vm.input);
+
+	vm.tape = calloc(c->tape_size, c->cell_size);
+
+	if (vm.tape == NULL || Summary_init(&vm.summary, c->tape_size, c->cell_size) != 0) goto done;
+
+	// All of the input is there from the start
+	if (c->input_length > 0 && InputSource_push(&vm.input, c->input_length, c->input) != 0) goto done;
+	InputSource_close(&vm.input);
+
+	if (interpreter_load(&vm, c->length, c->program) != 0) goto done;
+	if (tiered) compile_loops(&vm);
+
+	const double start = now();
+	interpreter_run(&vm, budget);
+	r->time = now() - start;
+
+	r->finished = vm.status == INTERPRETER_END;
+	r->steps = vm.steps;
+	r->pointer = vm.current_cell;
+	r->output_bytes = vm.output_bytes;
+
+	const size_t kept = (vm.output_bytes < OUTPUT_MAX) ? vm.output_bytes : OUTPUT_MAX;
+	StringCassette_tail(&vm.output, kept, r->output);
+
+	for (size_t i=0; i < c->tape_size; ++i) {
+		r->tape[i] = vm_get_cell(&vm, i);
+	}
+
+	result = 0;
+
+done:
+	interpreter_unload(&vm);
+	free(vm.tape);
+	Summary_free(&vm.summary);
+	InputSource_free(&vm.input);
+	StringCassette_free(&vm.output);
+	Queue_free(&vm.instructionQueue);
+
+	return result;
+}
+
+/*
+ * Reads a whole file. Returns NULL on failure.
+ */
+static char *read_file(const char *path, size_t *length) {
+	FILE *fp = fopen(path, "rb");
+	char *data = NULL;
+	size_t capacity = 0, n;
+
+	if (fp == NULL) return NULL;
+
+	*length = 0;
+
+	do {
+		if (*length == capacity) {
+			capacity = capacity ? capacity * 2 : 65536;
+			char *grown = realloc(data, capacity);
+
+			if (grown == NULL) {
+				free(data);
+				fclose(fp);
+				return NULL;
+			}
+
+			data = grown;
+		}
+
+		n = fread(data + *length, 1, capacity - *length, fp);
+		*length += n;
+	} while (n > 0);
+
+	fclose(fp);
+	return data;
+}
+
+/*
+ * Helper function which makes the path of a file in the scratch directory
+ */
+static const char *scratch_path(const char *name) {
+	static char paths[4][4096];
+	static int next = 0;
+
+	char *path = paths[next++ % 4];
+	snprintf(path, sizeof(paths[0]), "%s/%s", scratch, name);
+
+	return path;
+}
+
+/*
+ * Removes the scratch directory, however bfcheck exits
+ */
+static void remove_scratch(void) {
+	unlink(scratch_path("program"));
+	unlink(scratch_path("input"));
+	unlink(scratch_path("output"));
+	unlink(scratch_path("state"));
+	rmdir(scratch);
+}
+
+/*
+ * Runs a program translated to C. Returns -1 with errno set if the C compiler
+ * couldn't be run.
+ */
+static int run_c(const struct Case *c, unsigned flags, struct Result *r) {
+	const struct CodegenOptions opt = {
+		.cell_size = c->cell_size,
+		.tape_size = c->tape_size,
+		.eof_behaviour = c->eof,
+		.dump_state = true
+	};
+	const char *exe = scratch_path("program");
+	posix_spawn_file_actions_t actions;
+	Program program;
+	int status = 0, err;
+	pid_t pid;
+
+	r->finished = false;
+	r->steps = UINT64_MAX;
+
+	if (Program_compile(&program, c->length, c->program, c->tape_size, flags) != 0) return -1;
+
+	errno = 0;
+	err = codegen_executable(&program, exe, &opt);
+	Program_free(&program);
+
+	if (err != 0) return (errno != 0) ? -1 : 0;
+
+	posix_spawn_file_actions_init(&actions);
+	posix_spawn_file_actions_addopen(&actions, 0, scratch_path("input"), O_RDONLY, 0);
+	posix_spawn_file_actions_addopen(&actions, 1, scratch_path("output"), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	posix_spawn_file_actions_addopen(&actions, 2, scratch_path("state"), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+
+	const double start = now();
+	err = posix_spawn(&pid, exe, &actions, NULL, (char *[]){ (char *)exe, NULL }, environ);
+	posix_spawn_file_actions_destroy(&actions);
+
+	if (err != 0) {
+		errno = err;
+		return -1;
+	}
+
+	// Programs which get stuck are killed
+	while (waitpid(pid, &status, WNOHANG) == 0) {
+		if (now() - start > RUN_TIMEOUT) {
+			kill(pid, SIGKILL);
+			waitpid(pid, &status, 0);
+			break;
+		}
+
+		nanosleep(&(struct timespec){ .tv_nsec = 100000 }, NULL);
+	}
+
+	r->time = now() - start;
+
+	size_t output_length, state_length;
+	char *output = read_file(scratch_path("output"), &output_length);
+	uint64_t *state = (uint64_t *)read_file(scratch_path("state"), &state_length);
+
+	if (output != NULL && state != NULL && WIFEXITED(status) && WEXITSTATUS(status) == 0
+	 && state_length == (c->tape_size + 1) * sizeof(uint64_t)) {
+		keep_output(r, output_length, output);
+
+		r->finished = true;
+		r->pointer = state[0];
+		memcpy(r->tape, state + 1, c->tape_size * sizeof(uint64_t));
+	}
+
+	free(output);
+	free(state);
+
+	return 0;
+}
+
+/*
+ * Prints a program, escaping nothing as it only holds instructions
+ */
+static void print_program(const struct Case *c) {
+	if (c->length > 2000) {
+		fprintf(stderr, "  (%zu instructions)\n", c->length);
+	} else {
+		fprintf(stderr, "  program: %.*s\n", (int)c->length, c->program);
+	}
+}
+
+/*
+ * Compares a run with the reference's, printing the first difference.
+ * Returns true if they match.
+ */
+static bool compare(const struct Case *c, enum Engine engine, const struct Result *ref, const struct Result *r) {
+	char what[128] = "";
+
+	if (!r->finished) {
+		snprintf(what, sizeof(what), "didn't finish");
+	} else if (r->steps != UINT64_MAX && r->steps != ref->steps) {
+		snprintf(what, sizeof(what), "took %" PRIu64 " steps, not %" PRIu64, r->steps, ref->steps);
+	} else if (r->pointer != ref->pointer) {
+		snprintf(what, sizeof(what), "ended on cell %zu, not %zu", r->pointer, ref->pointer);
+	} else if (r->output_bytes != ref->output_bytes) {
+		snprintf(what, sizeof(what), "output %" PRIu64 " bytes, not %" PRIu64, r->output_bytes, ref->output_bytes);
+	} else if (memcmp(r->output, ref->output, (ref->output_bytes < OUTPUT_MAX) ? ref->output_bytes : OUTPUT_MAX) != 0) {
+		snprintf(what, sizeof(what), "output different bytes");
+	} else {
+		const size_t i = tape_compare((const uint8_t *)r->tape, (const uint8_t *)ref->tape,
+									  c->tape_size * sizeof(uint64_t)) / sizeof(uint64_t);
+
+		if (i < c->tape_size) {
+			snprintf(what, sizeof(what), "left cell %zu as %" PRIu64 ", not %" PRIu64, i, r->tape[i], ref->tape[i]);
+		}
+	}
+
+	if (*what == '\0') return true;
+
+	fprintf(stderr, "%s: %s %s (cell size %zu, tape %zu, EOF %s)\n",
+		c->name, engine_names[engine], what, c->cell_size, c->tape_size, eof_names[c->eof]);
+	print_program(c);
+
+	return false;
+}
+
+/*
+ * Runs a program on every engine with every cell size. Returns the number of
+ * cell sizes it was skipped for, because it didn't finish in time.
+ */
+static int check(struct Case *c, const struct Options *opt, struct Result *ref, struct Result *r) {
+	int skipped = 0;
+
+	// The C engines read their input from a file
+	if (opt->compiled) {
+		FILE *fp = fopen(scratch_path("input"), "wb");
+
+		if (fp == NULL || fwrite(c->input, 1, c->input_length, fp) != c->input_length || fclose(fp) != 0) {
+			perror(scratch_path("input"));
+			exit(2);
+		}
+	}
+
+	for (size_t cell_size = 1; cell_size <= 8; ++cell_size) {
+		double times[ENGINE_COUNT] = { 0 };
+
+		c->cell_size = cell_size;
+
+		memset(ref->tape, 0, c->tape_size * sizeof(uint64_t));
+		ref->output_bytes = 0;
+		run_reference(c, opt->budget, ref);
+
+		if (!ref->finished) {
+			++skipped;
+			continue;
+		}
+
+		for (int engine=0; engine < ENGINE_COUNT; ++engine) {
+			memset(r->tape, 0, c->tape_size * sizeof(uint64_t));
+			r->output_bytes = 0;
+
+			switch (engine) {
+				case ENGINE_INTERPRETER:
+				case ENGINE_TIERED:
+					if (run_vm(c, opt->budget, engine == ENGINE_TIERED, r) != 0) {
+						perror("Unable to run the interpreter");
+						exit(2);
+					}
+					break;
+				default:
+					if (!opt->compiled) continue;
+
+					const unsigned flags = (engine == ENGINE_C) ? 0
+						: (engine == ENGINE_C_RUNS) ? PROGRAM_FOLD_RUNS : PROGRAM_OPTIMISE;
+
+					if (run_c(c, flags, r) != 0) {
+						perror("Unable to run the C compiler");
+						exit(2);
+					}
+					break;
+			}
+
+			++totals[engine].runs;
+			if (!compare(c, engine, ref, r)) ++totals[engine].mismatches;
+
+			totals[engine].time += r->time;
+			totals[engine].reference += ref->time;
+			times[engine] = r->time;
+		}
+
+		++reference_totals.runs;
+		reference_totals.time += ref->time;
+
+		if (opt->verbose) {
+			printf("%-24s %zu  reference %.6f", c->name, cell_size, ref->time);
+
+			for (int engine=0; engine < ENGINE_COUNT; ++engine) {
+				if (times[engine] > 0) printf("  %s %.6f", engine_names[engine], times[engine]);
+			}
+
+			printf("\n");
+		}
+	}
+
+	return skipped;
+}
+
+/* The fuzzer */
+static uint64_t seed;
+
+static uint64_t rng() {
+	// splitmix64
+	uint64_t z = (seed += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+#define PICK(n) (rng() % (n))
+
+struct Buffer {
+	char *data;
+	size_t length;
+	size_t capacity;
+};
+
+static void put(struct Buffer *b, const char *s, size_t n) {
+	if (b->length + n > b->capacity) {
+		while (b->length + n > b->capacity) b->capacity = b->capacity ? b->capacity * 2 : 256;
+
+		if ((b->data = realloc(b->data, b->capacity)) == NULL) {
+			perror("realloc");
+			exit(2);
+		}
+	}
+
+	memcpy(b->data + b->length, s, n);
+	b->length += n;
+}
+
+static void put_run(struct Buffer *b, char ch, size_t n) {
+	for (size_t i=0; i < n; ++i) put(b, &ch, 1);
+}
+
+// Loops which are folded into single ops
+static const char *idioms[] = {
+	"[-]", "[+]", "[>]", "[<]", "[>>]", "[<<<]", "[->+<]", "[-<+>]", "[+>-<]",
+	"[->>+++<<]", "[->+>+<<]", "[-<<->>]", "[->-->+++<<]", "[>+<-]", "[-<+>>++<]"
+};
+
+/*
+ * Generates a block of a random program:
+ *
+ *   block := item*
+ *   item  := run of + or - | run of > or < | . | , | idiom | [ block ]
+ */
+static void generate_block(struct Buffer *b, int depth) {
+	const size_t items = 1 + PICK(8);
+
+	for (size_t i=0; i < items; ++i) {
+		switch (PICK(10)) {
+			case 0: case 1: case 2:
+				// mostly short runs, with the odd one long enough to wrap a cell
+				put_run(b, PICK(2) ? '+' : '-', PICK(8) ? 1 + PICK(12) : 200 + PICK(400));
+				break;
+			case 3: case 4:
+				put_run(b, PICK(2) ? '>' : '<', 1 + PICK(5));
+				break;
+			case 5:
+				put(b, ".", 1);
+				break;
+			case 6:
+				put(b, ",", 1);
+				break;
+			case 7: case 8: {
+				const char *idiom = idioms[PICK(sizeof(idioms) / sizeof(*idioms))];
+				put(b, idiom, strlen(idiom));
+				break;
+			}
+			case 9:
+				if (depth >= 3) break;
+
+				// Counting the current cell down gives the loop a chance of
+				// ending
+				put(b, PICK(2) ? "[-" : "[", PICK(2) ? 2 : 1);
+				generate_block(b, depth + 1);
+				put(b, "]", 1);
+				break;
+		}
+	}
+}
+
+/*
+ * Generates a random program, along with its input and the VM it runs on
+ */
+static void generate(struct Buffer *b, char *input, size_t *input_length, size_t *tape_size, enum EOFBehaviour *eof) {
+	static const size_t tape_sizes[] = { 1, 3, 8, 17, 64, 300 };
+
+	b->length = 0;
+	generate_block(b, 0);
+
+	// Now and then, brackets without partners
+	if (PICK(20) == 0) put(b, "]", 1);
+	if (PICK(20) == 0) put(b, "[", 1);
+
+	*input_length = PICK(17);
+
+	for (size_t i=0; i < *input_length; ++i) {
+		input[i] = PICK(4) ? (char)PICK(256) : (PICK(2) ? 0 : (char)0xFF);
+	}
+
+	*tape_size = tape_sizes[PICK(sizeof(tape_sizes) / sizeof(*tape_sizes))];
+	*eof = PICK(3);
+}
+
+static void print_totals(void) {
+	// Scans are only as fast as the kernels they run on
+	printf("Tape kernels: %s\n", tape_kernel());
+	printf("%-12s %8s %10s %10s %8s\n", "engine", "runs", "mismatches", "time (s)", "speedup");
+	printf("%-12s %8" PRIu64 " %10s %10.3f %8s\n", "reference", reference_totals.runs, "-", reference_totals.time, "1.00");
+
+	for (int engine=0; engine < ENGINE_COUNT; ++engine) {
+		const struct Totals *t = &totals[engine];
+
+		if (t->runs == 0) continue;
+
+		printf("%-12s %8" PRIu64 " %10" PRIu64 " %10.3f %8.2f\n", engine_names[engine],
+			t->runs, t->mismatches, t->time, (t->time > 0) ? t->reference / t->time : 0.0);
+	}
+}
+
+int main(int argc, char *argv[]) {
+	struct Options opt = {
+		.budget = 10000000,
+		.tape_size = 1024,
+		.eof = EOF_UNCHANGED,
+		.input = "",
+		.compiled = true
+	};
+	uint64_t count = 20;
+	int ch, skipped = 0;
+
+	seed = time(NULL);
+
+	while ((ch = getopt(argc, argv, "e:hi:m:n:r:s:vx")) != -1) {
+		switch (ch) {
+			case 'e':
+				if (strcmp(optarg, "keep") == 0) {
+					opt.eof = EOF_UNCHANGED;
+				} else if (strcmp(optarg, "0") == 0) {
+					opt.eof = EOF_ZERO;
+				} else if (strcmp(optarg, "-1") == 0) {
+					opt.eof = EOF_NEGATIVE;
+				} else {
+					fprintf(stderr, "Invalid argument for option -e: '%s'\n", optarg);
+					return 2;
+				}
+				break;
+			case 'h':
+				print_help(argv[0]);
+				return 0;
+			case 'i':
+				if ((opt.input = read_file(optarg, &opt.input_length)) == NULL) {
+					perror(optarg);
+					return 2;
+				}
+				break;
+			case 'm':
+				opt.tape_size = strtoull(optarg, NULL, 10);
+
+				if (opt.tape_size < 1) {
+					fprintf(stderr, "Invalid argument for option -m: '%s'\n", optarg);
+					return 2;
+				}
+				break;
+			case 'n':
+				count = strtoull(optarg, NULL, 10);
+				break;
+			case 'r':
+				seed = strtoull(optarg, NULL, 0);
+				break;
+			case 's':
+				opt.budget = strtoull(optarg, NULL, 10);
+				break;
+			case 'v':
+				opt.verbose = true;
+				break;
+			case 'x':
+				opt.compiled = false;
+				break;
+			default:
+				return 2;
+		}
+	}
+
+	if (opt.compiled) {
+		static char template[4096];
+		const char *tmpdir = getenv("TMPDIR");
+
+		if (tmpdir == NULL || *tmpdir == '\0') tmpdir = "/tmp";
+		snprintf(template, sizeof(template), "%s/bfcheck-XXXXXX", tmpdir);
+
+		if ((scratch = mkdtemp(template)) == NULL) {
+			perror(template);
+			return 2;
+		}
+
+		atexit(remove_scratch);
+	}
+
+	// Results are made big enough for any of the tapes
+	size_t max_tape = (opt.tape_size > 300) ? opt.tape_size : 300;
+	struct Result *ref = calloc(1, sizeof(struct Result)), *r = calloc(1, sizeof(struct Result));
+
+	if (ref == NULL || r == NULL || (ref->tape = malloc(max_tape * sizeof(uint64_t))) == NULL
+	 || (r->tape = malloc(max_tape * sizeof(uint64_t))) == NULL) {
+		perror("malloc");
+		return 2;
+	}
+
+	/* Programs from files */
+	for (int i=optind; i < argc; ++i) {
+		struct Case c = {
+			.input = opt.input,
+			.input_length = opt.input_length,
+			.tape_size = opt.tape_size,
+			.eof = opt.eof
+		};
+		size_t length;
+		char *src = read_file(argv[i], &length);
+
+		if (src == NULL || make_case(&c, argv[i], length, src) != 0) {
+			perror(argv[i]);
+			return 2;
+		}
+
+		free(src);
+
+		if (check(&c, &opt, ref, r) > 0) {
+			fprintf(stderr, "%s: Didn't finish in %" PRIu64 " steps; skipped\n", argv[i], opt.budget);
+		}
+
+		free_case(&c);
+	}
+
+	/* Generated programs */
+	printf("Generating %" PRIu64 " programs with seed %" PRIu64 "\n", count, seed);
+
+	struct Buffer b = { 0 };
+	char input[16];
+	char name[64];
+
+	for (uint64_t i=0; i < count; ++i) {
+		struct Case c = { .input = input };
+
+		// Each program can be generated again on its own from its seed
+		const uint64_t program_seed = seed;
+		snprintf(name, sizeof(name), "generated (seed %" PRIu64 ")", program_seed);
+
+		generate(&b, input, &c.input_length, &c.tape_size, &c.eof);
+
+		if (make_case(&c, name, b.length, b.data) != 0) {
+			perror("malloc");
+			return 2;
+		}
+
+		skipped += check(&c, &opt, ref, r) > 0;
+		free_case(&c);
+
+		seed = program_seed;
+		rng();
+		seed += rng();
+	}
+
+	if (skipped > 0) printf("%d generated programs didn't finish in time and were skipped\n", skipped);
+
+	print_totals();
+
+	for (int engine=0; engine < ENGINE_COUNT; ++engine) {
+		if (totals[engine].mismatches > 0) return 1;
+	}
+
+	return 0;
+}
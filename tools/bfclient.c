@@ -0,0 +1,449 @@
+/*
+ * bfclient - drives a bfdbg debug server (bfdbg -S) from the command line
+ *
+ * Commands are sent to the server in batches, without waiting for each reply,
+ * and the replies are printed one per line as they come back. A batch ends at
+ * each wait command, which holds the rest back until the run before it has
+ * stopped. If no run was started, because there wasn't one or the server
+ * refused it, there is nothing to wait for.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+
+static const char *status_names[] = { "ok", "end", "input", "break", "until" };
+
+/*
+ * A request which has been sent and not answered yet
+ */
+struct Pending {
+	uint8_t type;
+	uint64_t cells;  // for reads, how many cells were asked for
+};
+
+void print_help(char *prgname) {
+	printf("Usage: %s [-h] SOCKET COMMAND...\n\n", prgname);
+
+	printf("Sends commands to the bfdbg debug server listening on SOCKET (bfdbg -S)\n"
+		   "and prints the replies, along with the program's output and where\n"
+		   "runs stop.\n\n");
+
+	printf("Commands:\n");
+	printf("  state            \tPrint the state of the VM.\n");
+	printf("  load FILE        \tAppend FILE to the program.\n");
+	printf("  replace FILE     \tReplace the program with FILE and reset.\n");
+	printf("  reset            \tReset the VM, keeping the program.\n");
+	printf("  run STEPS        \tStart running for at most STEPS instructions\n"
+		   "                   \t(0 for no limit).\n");
+	printf("  until COND       \tStart running until COND, which is 'break',\n"
+		   "                   \t'output', 'input', @CELL or CELL=VAL.\n");
+	printf("  wait             \tWait for the run to stop before sending more.\n");
+	printf("  step N           \tRun N instructions.\n");
+	printf("  pause            \tStop a run.\n");
+	printf("  break INDEX      \tSet a breakpoint on an instruction.\n");
+	printf("  clear INDEX      \tClear a breakpoint.\n");
+	printf("  breaks           \tList the breakpoints.\n");
+	printf("  read START COUNT \tPrint COUNT cells from START.\n");
+	printf("  input TEXT       \tSend TEXT as program input.\n");
+	printf("  eof              \tClose the program's input.\n");
+	printf("  quit             \tShut the server down.\n\n");
+
+	printf("For example, to run a program until it prints something and then look\n"
+		   "at the start of the tape:\n"
+		   "  %s /tmp/bfdbg.sock replace prog.bf until output wait read 0 16\n", prgname);
+}
+
+/*
+ * Reads exactly n bytes from the server. Returns false if the connection
+ * closed first.
+ */
+static bool read_full(int fd, void *buf, size_t n) {
+	for (size_t got = 0; got < n; ) {
+		const ssize_t r = read(fd, (char *)buf + got, n - got);
+
+		if (r < 0 && errno == EINTR) continue;
+		if (r <= 0) return false;
+
+		got += r;
+	}
+
+	return true;
+}
+
+/*
+ * Writes exactly n bytes to the server
+ */
+static bool write_full(int fd, const void *buf, size_t n) {
+	for (size_t put = 0; put < n; ) {
+		const ssize_t w = write(fd, (const char *)buf + put, n - put);
+
+		if (w < 0 && errno == EINTR) continue;
+		if (w <= 0) return false;
+
+		put += w;
+	}
+
+	return true;
+}
+
+/*
+ * Reads a whole file into memory. Returns NULL and sets errno on failure.
+ */
+static char *read_file(const char *path, size_t *length) {
+	FILE *fp = fopen(path, "r");
+	char *data = NULL;
+	size_t capacity = 0, n;
+
+	if (fp == NULL) return NULL;
+
+	*length = 0;
+
+	do {
+		if (*length == capacity) {
+			capacity = capacity ? capacity * 2 : 65536;
+			char *grown = realloc(data, capacity);
+
+			if (grown == NULL) {
+				free(data);
+				fclose(fp);
+				return NULL;
+			}
+
+			data = grown;
+		}
+
+		n = fread(data + *length, 1, capacity - *length, fp);
+		*length += n;
+	} while (n > 0);
+
+	fclose(fp);
+	return data;
+}
+
+/*
+ * Parses a number argument, or exits
+ */
+static uint64_t number(const char *arg) {
+	char *end;
+	errno = 0;
+	const uint64_t v = strtoull(arg, &end, 0);
+
+	if (*arg == '\0' || *end != '\0' || errno != 0) {
+		fprintf(stderr, "Not a number: '%s'\n", arg);
+		exit(1);
+	}
+
+	return v;
+}
+
+/*
+ * Parses a condition for the until command into its RunUntil, cell and value,
+ * or exits
+ */
+static void condition(const char *arg, uint64_t until[3]) {
+	const char *eq = strchr(arg, '=');
+
+	if (strcmp(arg, "break") == 0) {
+		until[0] = UNTIL_BREAK;
+	} else if (strcmp(arg, "output") == 0) {
+		until[0] = UNTIL_OUTPUT;
+	} else if (strcmp(arg, "input") == 0) {
+		until[0] = UNTIL_INPUT;
+	} else if (*arg == '@') {
+		until[0] = UNTIL_POINTER;
+		until[1] = number(arg + 1);
+	} else if (eq != NULL) {
+		char cell[32];
+
+		if ((size_t)(eq - arg) >= sizeof(cell)) {
+			fprintf(stderr, "Not a number: '%s'\n", arg);
+			exit(1);
+		}
+
+		memcpy(cell, arg, eq - arg);
+		cell[eq - arg] = '\0';
+
+		until[0] = UNTIL_VALUE;
+		until[1] = number(cell);
+		until[2] = number(eq + 1);
+	} else {
+		fprintf(stderr, "Unknown condition: '%s'\n", arg);
+		exit(1);
+	}
+}
+
+static void print_state(const char *what, const struct ServerState *st) {
+	printf("%s: steps=%" PRIu64 " ip=%" PRIu64 "/%" PRIu64 " cell=%" PRIu64 " output=%" PRIu64 " status=%s%s\n",
+		what, st->steps, st->ip, st->program_length, st->current_cell, st->output_bytes,
+		(st->status < sizeof(status_names) / sizeof(*status_names)) ? status_names[st->status] : "?",
+		st->running ? " running" : "");
+}
+
+/*
+ * Prints a message from the server. Returns 1 if it answered a request, 2 if
+ * a run stopped and 0 for anything else.
+ */
+static int print_message(const struct ServerFrame *frame, const uint8_t *payload, const struct Pending *pending) {
+	uint64_t v;
+
+	switch (frame->type) {
+		case SERVER_OUTPUT:
+			memcpy(&v, payload, sizeof(uint64_t));
+			if (v > 0) printf("output: (%" PRIu64 " bytes lost)\n", v);
+
+			printf("output: \"");
+
+			for (size_t i=sizeof(uint64_t); i < frame->length; ++i) {
+				const uint8_t ch = payload[i];
+
+				if (ch == '\n')
+					printf("\\n");
+				else if (ch == '"' || ch == '\\')
+					printf("\\%c", ch);
+				else if (ch < 0x20 || ch >= 0x7F)
+					printf("\\x%02X", ch);
+				else
+					putchar(ch);
+			}
+
+			printf("\"\n");
+			return 0;
+		case SERVER_STOPPED:
+			print_state("stopped", (const struct ServerState *)payload);
+			return 2;
+		case SERVER_ERROR:
+			printf("error: %.*s\n", (int)(frame->length - sizeof(uint64_t)), (const char *)payload + sizeof(uint64_t));
+			return 1;
+		case SERVER_REPLY:
+			break;
+		default:
+			return 0;
+	}
+
+	switch (pending->type) {
+		case SERVER_STATE:
+		case SERVER_LOAD:
+		case SERVER_RESET:
+		case SERVER_STEP:
+		case SERVER_PAUSE:
+			print_state("state", (const struct ServerState *)payload);
+			break;
+		case SERVER_BREAK:
+			memcpy(&v, payload, sizeof(uint64_t));
+			printf("breakpoints: %" PRIu64 "\n", v);
+			break;
+		case SERVER_BREAKS:
+			printf("breakpoints:");
+
+			for (size_t i=0; i < frame->length / sizeof(uint64_t); ++i) {
+				memcpy(&v, payload + i * sizeof(uint64_t), sizeof(uint64_t));
+				printf(" %" PRIu64, v);
+			}
+
+			printf("\n");
+			break;
+		case SERVER_READ: {
+			const size_t cell_size = pending->cells ? frame->length / pending->cells : 0;
+
+			printf("cells:");
+
+			for (size_t i=0; i < pending->cells; ++i) {
+				v = 0;
+				memcpy(&v, payload + i * cell_size, cell_size);
+				printf(" %" PRIu64, v);
+			}
+
+			printf("\n");
+			break;
+		}
+		default:
+			printf("ok\n");
+			break;
+	}
+
+	return 1;
+}
+
+int main(int argc, char *argv[]) {
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (argc >= 2 && strcmp(argv[1], "-h") == 0) {
+		print_help(argv[0]);
+		return 0;
+	}
+
+	if (argc < 3) {
+		fprintf(stderr, "Usage: %s [-h] SOCKET COMMAND...\n", argv[0]);
+		return 1;
+	}
+
+	if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: Socket path too long\n", argv[1]);
+		return 1;
+	}
+
+	strcpy(addr.sun_path, argv[1]);
+
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		perror(argv[1]);
+		return 1;
+	}
+
+	struct Pending *pending = calloc(argc, sizeof(struct Pending));
+	uint32_t sent = 0, answered = 0;
+	int arg = 2;
+
+	if (pending == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	while (arg < argc) {
+		bool waiting = false;
+
+		// Send everything up to the next wait in one go
+		while (arg < argc && !waiting) {
+			const char *cmd = argv[arg++];
+			struct ServerFrame frame = { .id = sent + 1 };
+			uint64_t args[4] = { 0 };
+			const void *payload = args;
+			char *file = NULL;
+
+			// Commands which take an argument
+			const bool takes = strcmp(cmd, "load") == 0 || strcmp(cmd, "replace") == 0
+				|| strcmp(cmd, "run") == 0 || strcmp(cmd, "until") == 0 || strcmp(cmd, "step") == 0
+				|| strcmp(cmd, "break") == 0 || strcmp(cmd, "clear") == 0 || strcmp(cmd, "input") == 0
+				|| strcmp(cmd, "read") == 0;
+
+			if (takes && arg + (strcmp(cmd, "read") == 0) >= argc) {
+				fprintf(stderr, "%s needs %s\n", cmd, strcmp(cmd, "read") == 0 ? "two arguments" : "an argument");
+				return 1;
+			}
+
+			if (strcmp(cmd, "state") == 0) {
+				frame.type = SERVER_STATE;
+			} else if (strcmp(cmd, "load") == 0 || strcmp(cmd, "replace") == 0) {
+				size_t length;
+
+				if ((file = read_file(argv[arg], &length)) == NULL) {
+					perror(argv[arg]);
+					return 1;
+				}
+
+				frame.type = SERVER_LOAD;
+				frame.flags = (*cmd == 'r') ? SERVER_LOAD_REPLACE : 0;
+				frame.length = length;
+				payload = file;
+				++arg;
+			} else if (strcmp(cmd, "reset") == 0) {
+				frame.type = SERVER_RESET;
+			} else if (strcmp(cmd, "run") == 0) {
+				frame.type = SERVER_RUN;
+				frame.length = sizeof(uint64_t);
+				args[0] = number(argv[arg++]);
+			} else if (strcmp(cmd, "until") == 0) {
+				frame.type = SERVER_RUN;
+				frame.length = 4 * sizeof(uint64_t);
+				condition(argv[arg++], args + 1);
+			} else if (strcmp(cmd, "wait") == 0) {
+				waiting = true;
+				continue;
+			} else if (strcmp(cmd, "step") == 0) {
+				frame.type = SERVER_STEP;
+				frame.length = sizeof(uint64_t);
+				args[0] = number(argv[arg++]);
+			} else if (strcmp(cmd, "pause") == 0) {
+				frame.type = SERVER_PAUSE;
+			} else if (strcmp(cmd, "break") == 0 || strcmp(cmd, "clear") == 0) {
+				frame.type = SERVER_BREAK;
+				frame.flags = (*cmd == 'c') ? SERVER_BREAK_CLEAR : 0;
+				frame.length = sizeof(uint64_t);
+				args[0] = number(argv[arg++]);
+			} else if (strcmp(cmd, "breaks") == 0) {
+				frame.type = SERVER_BREAKS;
+			} else if (strcmp(cmd, "read") == 0) {
+				frame.type = SERVER_READ;
+				frame.length = 2 * sizeof(uint64_t);
+				args[0] = number(argv[arg++]);
+				args[1] = number(argv[arg++]);
+				pending[sent].cells = args[1];
+			} else if (strcmp(cmd, "input") == 0) {
+				frame.type = SERVER_INPUT;
+				frame.length = strlen(argv[arg]);
+				payload = argv[arg++];
+			} else if (strcmp(cmd, "eof") == 0) {
+				frame.type = SERVER_INPUT;
+				frame.flags = SERVER_INPUT_EOF;
+			} else if (strcmp(cmd, "quit") == 0) {
+				frame.type = SERVER_QUIT;
+			} else {
+				fprintf(stderr, "Unknown command: '%s'\n", cmd);
+				return 1;
+			}
+
+			pending[sent++].type = frame.type;
+
+			if (!write_full(fd, &frame, sizeof(frame)) || !write_full(fd, payload, frame.length)) {
+				perror("write");
+				return 1;
+			}
+
+			free(file);
+		}
+
+		// Then print what comes back. The run to wait for is the last one
+		// the server accepted.
+		uint32_t run_id = 0;
+		bool stopped = false;
+
+		while (answered < sent || (waiting && run_id != 0 && !stopped)) {
+			struct ServerFrame frame;
+			uint8_t *payload;
+
+			if (!read_full(fd, &frame, sizeof(frame))) {
+				fprintf(stderr, "%s: The server hung up\n", argv[1]);
+				return 1;
+			}
+
+			if ((payload = malloc(frame.length + 1)) == NULL || !read_full(fd, payload, frame.length)) {
+				fprintf(stderr, "%s: The server hung up\n", argv[1]);
+				return 1;
+			}
+
+			const uint32_t id = (frame.id >= 1 && frame.id <= sent) ? frame.id - 1 : 0;
+
+			switch (print_message(&frame, payload, &pending[id])) {
+				case 1:
+					++answered;
+
+					if (frame.type == SERVER_REPLY && pending[id].type == SERVER_RUN) {
+						run_id = frame.id;
+						stopped = false;
+					}
+					break;
+				case 2:
+					if (frame.id == run_id) stopped = true;
+					break;
+			}
+
+			free(payload);
+		}
+	}
+
+	free(pending);
+	close(fd);
+
+	return 0;
+}
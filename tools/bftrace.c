@@ -0,0 +1,296 @@
+/*
+ * bftrace - reads the execution traces written by bfdbg -t
+ *
+ * Traces only store the VM's state at the start of each basic block. The
+ * individual steps in between are reconstructed here by simulating the
+ * program against a shadow copy of the tape.
+ */
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/*
+ * The state of the simulated VM
+ */
+struct Shadow {
+	uint64_t mask;
+	size_t tape_size;
+	uint64_t *tape;
+
+	char *program;
+	size_t *jumps;
+	size_t length;
+	size_t capacity;
+	size_t *open;
+	size_t open_length;
+
+	uint64_t step;
+	size_t ip;
+	size_t cell;
+};
+
+/*
+ * Output options
+ */
+struct Options {
+	bool blocks;  // print the block records instead of every step
+	bool csv;
+	uint64_t from;
+	uint64_t count;
+};
+
+static uint64_t printed = 0;
+
+void print_help(char *prgname) {
+	printf("Usage: %s [-bch] [-f STEP] [-n COUNT] TRACE\n\n", prgname);
+
+	printf("Prints the steps recorded in a bfdbg execution trace, one per line:\n"
+		   "the step number, instruction pointer, instruction, current cell\n"
+		   "and the cell's value before the instruction executed.\n\n");
+
+	printf("Options:\n");
+	printf("  -b      \tPrint the recorded block records rather than\n"
+		   "          \treconstructing every step.\n");
+	printf("  -c      \tConvert to CSV.\n");
+	printf("  -f STEP \tStart at step STEP.\n");
+	printf("  -h      \tDisplay this help message.\n");
+	printf("  -n COUNT\tPrint at most COUNT lines.\n");
+}
+
+/*
+ * Prints a single step. Returns false once enough lines have been printed.
+ */
+static bool emit(const struct Options *opt, uint64_t step, size_t ip, char op, size_t cell, uint64_t value) {
+	if (step < opt->from) return true;
+	if (opt->count != 0 && printed >= opt->count) return false;
+
+	if (op == 0) op = ' ';  // past the end of the program
+
+	if (opt->csv) {
+		printf("%" PRIu64 ",%zu,%c,%zu,%" PRIu64 "\n", step, ip, op, cell, value);
+	} else {
+		printf("%12" PRIu64 " %10zu %c %10zu %16" PRIX64 "\n", step, ip, op, cell, value);
+	}
+
+	++printed;
+	return true;
+}
+
+/*
+ * Appends instructions to the shadow program, matching brackets the same way
+ * the interpreter does.
+ */
+static int shadow_load(struct Shadow *s, size_t n, const char *src) {
+	if (s->length + n > s->capacity) {
+		while (s->length + n > s->capacity) s->capacity = s->capacity ? s->capacity * 2 : 1024;
+
+		s->program = realloc(s->program, s->capacity);
+		s->jumps = realloc(s->jumps, s->capacity * sizeof(size_t));
+		s->open = realloc(s->open, s->capacity * sizeof(size_t));
+
+		if (s->program == NULL || s->jumps == NULL || s->open == NULL) return -1;
+	}
+
+	for (size_t i=0; i < n; ++i, ++s->length) {
+		s->program[s->length] = src[i];
+
+		if (src[i] == '[') {
+			s->open[s->open_length++] = s->length;
+			s->jumps[s->length] = SIZE_MAX;
+		} else if (src[i] == ']') {
+			if (s->open_length > 0) {
+				size_t partner = s->open[--s->open_length];
+				s->jumps[s->length] = partner;
+				s->jumps[partner] = s->length;
+			} else {
+				s->jumps[s->length] = SIZE_MAX;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Simulates the shadow VM up to a step. Returns false once enough lines
+ * have been printed.
+ */
+static bool shadow_run(struct Shadow *s, const struct Options *opt, uint64_t until) {
+	while (s->step < until && s->ip < s->length) {
+		const char op = s->program[s->ip];
+		uint64_t *value = &s->tape[s->cell];
+
+		if (!opt->blocks && !emit(opt, s->step, s->ip, op, s->cell, *value)) return false;
+
+		switch (op) {
+			case '+': *value = (*value + 1) & s->mask; break;
+			case '-': *value = (*value - 1) & s->mask; break;
+			case '>': s->cell = (s->cell < s->tape_size-1) ? s->cell+1 : 0; break;
+			case '<': s->cell = (s->cell > 0) ? s->cell-1 : s->tape_size-1; break;
+			case '[':
+				if (*value == 0 && s->jumps[s->ip] != SIZE_MAX) s->ip = s->jumps[s->ip];
+				break;
+			case ']':
+				if (*value != 0 && s->jumps[s->ip] != SIZE_MAX) s->ip = s->jumps[s->ip];
+				break;
+			default:
+				// . has no effect on the tape, and the value read by , is
+				// picked up from the next block record
+				break;
+		}
+
+		++s->ip;
+		++s->step;
+	}
+
+	return true;
+}
+
+int main(int argc, char *argv[]) {
+	struct Options opt = { 0 };
+	struct Shadow s = { 0 };
+	struct stat st;
+	int ch, fd;
+
+	while ((ch = getopt(argc, argv, "bcf:hn:")) != -1) {
+		switch (ch) {
+			case 'b':
+				opt.blocks = true;
+				break;
+			case 'c':
+				opt.csv = true;
+				break;
+			case 'f':
+				opt.from = strtoull(optarg, NULL, 10);
+				break;
+			case 'h':
+				print_help(argv[0]);
+				return 0;
+			case 'n':
+				opt.count = strtoull(optarg, NULL, 10);
+				break;
+			default:
+				return 1;
+		}
+	}
+
+	if (optind >= argc) {
+		fprintf(stderr, "No trace file given\n");
+		fprintf(stderr, "To view the help message, use the -h option\n");
+		return 1;
+	}
+
+	if ((fd = open(argv[optind], O_RDONLY)) == -1 || fstat(fd, &st) == -1) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if ((size_t)st.st_size < sizeof(struct TraceHeader)) {
+		fprintf(stderr, "%s: Not a trace file\n", argv[optind]);
+		return 1;
+	}
+
+	const uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	const size_t length = st.st_size;
+	close(fd);
+
+	if (data == MAP_FAILED) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	madvise((void *)data, length, MADV_SEQUENTIAL);
+
+	struct TraceHeader hdr;
+	memcpy(&hdr, data, sizeof(hdr));
+
+	if (memcmp(hdr.magic, TRACE_MAGIC, 4) != 0 || hdr.version != TRACE_VERSION
+	 || hdr.cell_size < 1 || hdr.cell_size > 8 || hdr.tape_size < 1) {
+		fprintf(stderr, "%s: Not a trace file\n", argv[optind]);
+		return 1;
+	}
+
+	s.mask = (hdr.cell_size == 8) ? UINT64_MAX : (UINT64_C(1) << (hdr.cell_size * 8)) - 1;
+	s.tape_size = hdr.tape_size;
+	s.tape = calloc(s.tape_size, sizeof(uint64_t));
+
+	if (s.tape == NULL) {
+		perror("calloc");
+		return 1;
+	}
+
+	if (opt.csv) printf("step,ip,op,cell,value\n");
+
+	for (size_t pos = sizeof(hdr); pos + sizeof(struct TraceChunk) <= length; ) {
+		struct TraceChunk chunk;
+		memcpy(&chunk, data + pos, sizeof(chunk));
+		pos += sizeof(chunk);
+
+		switch (chunk.type) {
+			case TRACE_CHUNK_PROGRAM:
+				if (chunk.count > length - pos) goto truncated;
+
+				if (shadow_load(&s, chunk.count, (const char *)data + pos) != 0) {
+					perror("realloc");
+					return 1;
+				}
+
+				pos += chunk.count;
+				break;
+			case TRACE_CHUNK_BLOCKS:
+				if ((uint64_t)chunk.count * sizeof(struct TraceRecord) > length - pos) goto truncated;
+
+				for (uint32_t i=0; i < chunk.count; ++i, pos += sizeof(struct TraceRecord)) {
+					struct TraceRecord r;
+					memcpy(&r, data + pos, sizeof(r));
+
+					// fill in the steps since the last record
+					if (!opt.blocks && !shadow_run(&s, &opt, r.step)) return 0;
+
+					if (opt.blocks && !emit(&opt, r.step, TRACE_IP(&r), TRACE_OP(&r), r.cell, r.value)) {
+						return 0;
+					}
+
+					// then pick up the recorded state, which also brings in
+					// any values read by ,
+					s.step = r.step;
+					s.ip = TRACE_IP(&r);
+					s.cell = r.cell % s.tape_size;
+					s.tape[s.cell] = r.value & s.mask;
+				}
+				break;
+			case TRACE_CHUNK_RESET:
+				memset(s.tape, 0, s.tape_size * sizeof(uint64_t));
+				s.step = 0;
+				s.ip = 0;
+				s.cell = 0;
+				break;
+			case TRACE_CHUNK_UNLOAD:
+				// The next program chunk starts a new program
+				s.length = 0;
+				s.open_length = 0;
+				s.ip = 0;
+				break;
+			default:
+				fprintf(stderr, "%s: Unknown chunk type %" PRIu32 "\n", argv[optind], chunk.type);
+				return 1;
+		}
+	}
+
+	return 0;
+
+truncated:
+	fprintf(stderr, "%s: Trace is truncated\n", argv[optind]);
+	return 1;
+}